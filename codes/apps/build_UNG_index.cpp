@@ -19,6 +19,8 @@ int main(int argc, char** argv) {
     std::string index_type, scenario;
     ANNS::IdxType max_degree, Lbuild;       // Vamana
     float alpha;                            // Vamana
+    ANNS::BuildOptions build_options;
+    bool streaming;
 
     try {
         po::options_description desc{"Arguments"};
@@ -51,6 +53,22 @@ int main(int argc, char** argv) {
                            "Size of candidate set for building Vamana");
         desc.add_options()("alpha", po::value<float>(&alpha)->default_value(ANNS::default_paras::ALPHA),
                            "Alpha for building Vamana");
+        desc.add_options()("remap_labels", po::bool_switch(&build_options.remap_labels)->default_value(false),
+                           "Renumber labels by descending frequency, query labels are remapped automatically");
+        desc.add_options()("batch_insert", po::bool_switch(&build_options.batch_insert)->default_value(false),
+                           "Link Vamana graphs by exponentially growing batches instead of one point at a time");
+        desc.add_options()("nn_descent", po::bool_switch(&build_options.nn_descent)->default_value(false),
+                           "Build Vamana graphs from NN-Descent kNN graphs refined by pruning, instead of by insertions");
+        desc.add_options()("two_pass", po::bool_switch(&build_options.two_pass)->default_value(false),
+                           "Link Vamana graphs twice in a random order, first with alpha=1 then with the given alpha");
+        desc.add_options()("prune_cross_edges", po::bool_switch(&build_options.prune_cross_edges)->default_value(false),
+                           "Robust prune the cross-group candidates of each vector once over all out-neighbor groups, giving fewer and more diverse edges");
+        desc.add_options()("streaming", po::bool_switch(&streaming)->default_value(false),
+                           "Read the vectors in chunks during the build, overlapping loading with graph construction");
+        desc.add_options()("memory_budget", po::value<float>(&build_options.memory_budget_mb)->default_value(0),
+                           "Memory budget in MB for vectors and graphs during the build, 0 keeps everything in memory");
+        desc.add_options()("seed", po::value<uint32_t>(&build_options.seed)->default_value(ANNS::default_paras::RANDOM_SEED),
+                           "Seed of the random insertion order");
 
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -70,9 +88,21 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    // load base data
+    // nn_descent replaces the insertions that batch_insert and two_pass configure
+    if (build_options.nn_descent && (build_options.batch_insert || build_options.two_pass)) {
+        std::cerr << "nn_descent cannot be combined with batch_insert or two_pass" << std::endl;
+        return -1;
+    }
+
+    // load base data, or only the label sets when the vectors are streamed during the build
     std::shared_ptr<ANNS::IStorage> base_storage = ANNS::create_storage(data_type);
-    base_storage->load_from_file(base_bin_file, base_label_file);
+    if (streaming || build_options.memory_budget_mb > 0) {
+        build_options.stream_bin_file = base_bin_file;
+        build_options.stream_label_file = base_label_file;
+        build_options.spill_prefix = index_path_prefix;
+    } else {
+        base_storage->load_from_file(base_bin_file, base_label_file);
+    }
 
     // preparation
     std::cout << "Building Unified Navigating Graph index based on " << index_type << " algorithm ..." << std::endl;
@@ -81,7 +111,8 @@ int main(int argc, char** argv) {
 
     // build index
     ANNS::UniNavGraph index;
-    index.build(base_storage, distance_handler, scenario, index_type, num_threads, num_cross_edges, max_degree, Lbuild, alpha);
+    index.build(base_storage, distance_handler, scenario, index_type, num_threads, num_cross_edges, max_degree, Lbuild, alpha,
+                build_options);
     std::cout << "Index time: " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time).count() << "ms" << std::endl;
 
     // save index
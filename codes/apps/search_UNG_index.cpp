@@ -18,6 +18,7 @@ int main(int argc, char** argv) {
     ANNS::IdxType K, num_entry_points;
     std::vector<ANNS::IdxType> Lsearch_list;
     uint32_t num_threads;
+    ANNS::SearchOptions search_options;
 
     try {
         po::options_description desc{"Arguments"};
@@ -52,6 +53,34 @@ int main(int argc, char** argv) {
                             "Number of entry points in each entry group");
         desc.add_options()("Lsearch", po::value<std::vector<ANNS::IdxType>>(&Lsearch_list)->multitoken()->required(),
                            "Number of candidates to search in the graph");
+        desc.add_options()("entry_point_set_size", po::value<ANNS::IdxType>(&search_options.entry_point_set_size)->default_value(0),
+                           "Number of precomputed entry points scored per entry group, the closest num_entry_points seed the search, 0 to only score num_entry_points");
+        desc.add_options()("max_entry_groups", po::value<ANNS::IdxType>(&search_options.max_entry_groups)->default_value(0),
+                           "Only seed the search from the entry groups with the closest centroids, 0 for no limit");
+        desc.add_options()("group_size_weight", po::value<float>(&search_options.group_size_weight)->default_value(0),
+                           "Exponent of the group size discount when ranking entry groups, applied to distances shifted to the closest group");
+        desc.add_options()("scan_threshold", po::value<ANNS::IdxType>(&search_options.scan_threshold)->default_value(0),
+                           "Answer queries matching at most this many vectors by scanning them, 0 to always search the graph");
+        desc.add_options()("prefetch_lookahead", po::value<ANNS::IdxType>(&search_options.prefetch_lookahead)->default_value(ANNS::default_paras::PREFETCH_LOOKAHEAD),
+                           "Number of neighbors whose vectors are prefetched ahead during graph search");
+        desc.add_options()("num_interleaved_queries", po::value<ANNS::IdxType>(&search_options.num_interleaved_queries)->default_value(1),
+                           "Number of queries interleaved per thread to overlap memory stalls, 1 to disable");
+        desc.add_options()("beam_width", po::value<ANNS::IdxType>(&search_options.beam_width)->default_value(1),
+                           "Latency mode: number of candidates expanded concurrently per query, 1 to disable");
+        desc.add_options()("num_beam_threads", po::value<uint32_t>(&search_options.num_beam_threads)->default_value(1),
+                           "Latency mode: number of threads expanding the candidates of a single query");
+        desc.add_options()("patience", po::value<ANNS::IdxType>(&search_options.patience)->default_value(0),
+                           "Stop a query once its top-K are unchanged for this many expansions, 0 to disable");
+        desc.add_options()("distance_ratio", po::value<float>(&search_options.distance_ratio)->default_value(0),
+                           "Stop a query once the closest unexpanded candidate is this many times farther than the K-th result, 0 to disable");
+        desc.add_options()("time_budget_ms", po::value<float>(&search_options.time_budget_ms)->default_value(0),
+                           "Stop a query after this many milliseconds and return its partial result, 0 for no limit");
+        desc.add_options()("max_num_cmps", po::value<ANNS::IdxType>(&search_options.max_num_cmps)->default_value(0),
+                           "Stop a query after this many distance computations in the graph, 0 for no limit");
+        desc.add_options()("label_cache_capacity", po::value<ANNS::IdxType>(&search_options.label_cache_capacity)->default_value(0),
+                           "Number of query label sets whose entry groups are cached across queries, 0 to disable");
+        desc.add_options()("group_by_label_set", po::bool_switch(&search_options.group_by_label_set)->default_value(false),
+                           "Batch mode: bucket queries by label set, resolve entry groups once per bucket and run buckets together");
 
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -87,23 +116,39 @@ int main(int argc, char** argv) {
     auto results = new std::pair<ANNS::IdxType, float>[num_queries * K];
     
     // search
-    std::vector<float> all_cmps, all_qpss, all_recalls;
+    std::vector<float> all_cmps, all_qpss, all_recalls, all_hops, all_hops_saved, all_partials;
     std::cout << "Start querying ..." << std::endl;
     for (auto Lsearch : Lsearch_list) {
         auto start_time = std::chrono::high_resolution_clock::now();
         std::vector<float> num_cmps(num_queries);
-        index.search(query_storage, distance_handler, num_threads, Lsearch, num_entry_points, scenario, K, results, num_cmps);
+        std::vector<ANNS::QueryStats> query_stats;
+        index.search(query_storage, distance_handler, num_threads, Lsearch, num_entry_points, scenario, K, results, num_cmps, 
+                     search_options, &query_stats);
         auto time_cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
 
         // statistics
         std::cout << "- Lsearch=" << Lsearch << ", time=" << time_cost << "ms" << std::endl;
+        if (search_options.label_cache_capacity > 0) {
+            uint64_t num_hits, num_misses;
+            index.get_label_cache_stats(num_hits, num_misses);
+            std::cout << "  label cache: " << num_hits << " hits, " << num_misses << " misses" << std::endl;
+        }
         all_qpss.push_back(num_queries * 1000.0 / time_cost);
         all_cmps.push_back(std::accumulate(num_cmps.begin(), num_cmps.end(), 0) / num_queries);
         all_recalls.push_back(ANNS::calculate_recall(gt, results, num_queries, K));
+        float num_hops = 0, num_hops_saved = 0, num_partial = 0;
+        for (const auto& stats : query_stats) {
+            num_hops += stats.num_hops;
+            num_hops_saved += stats.num_hops_saved;
+            num_partial += stats.partial;
+        }
+        all_hops.push_back(num_hops / num_queries);
+        all_hops_saved.push_back(num_hops_saved / num_queries);
+        all_partials.push_back(num_partial * 100 / num_queries);
 
         // write to result file
         std::ofstream out(result_path_prefix + "result_L" + std::to_string(Lsearch) + ".csv");
-        out << "GT,Result" << std::endl;
+        out << "GT,Result,Hops,HopsSaved,Partial" << std::endl;
         for (auto i=0; i<num_queries; i++) {
             for (auto j=0; j<K; j++) {
                 out << gt[i*K+j].first << " ";
@@ -112,16 +157,18 @@ int main(int argc, char** argv) {
             for (auto j=0; j<K; j++) {
                 out << results[i*K+j].first << " ";
             }
-            out << std::endl;
+            out << "," << query_stats[i].num_hops << "," << query_stats[i].num_hops_saved 
+                << "," << query_stats[i].partial << std::endl;
         }
     }
 
     // write to result file
     fs::create_directories(result_path_prefix);
     std::ofstream out(result_path_prefix + "result.csv");
-    out << "L,Cmps,QPS,Recall" << std::endl;
+    out << "L,Cmps,QPS,Recall,Hops,HopsSaved,Partial(%)" << std::endl;
     for (auto i=0; i<Lsearch_list.size(); i++)
-        out << Lsearch_list[i] << "," << all_cmps[i] << "," << all_qpss[i] << "," << all_recalls[i] << std::endl;
+        out << Lsearch_list[i] << "," << all_cmps[i] << "," << all_qpss[i] << "," << all_recalls[i] 
+            << "," << all_hops[i] << "," << all_hops_saved[i] << "," << all_partials[i] << std::endl;
     out.close();
     std::cout << "- all done" << std::endl;
     return 0;
@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <string>
 
 
 namespace ANNS {
@@ -41,11 +42,69 @@ namespace ANNS {
         const IdxType MAX_CANDIDATE_SIZE = 750;
         const float ALPHA = 1.2;
         const float GRAPH_SLACK_FACTOR = 1.3;
+        const float BATCH_INSERT_MAX_FRACTION = 0.02;
+        const uint32_t RANDOM_SEED = 42;
+        const IdxType NN_DESCENT_MAX_ITERS = 10;
+        const float NN_DESCENT_SAMPLE_RATE = 0.5;
+        const float NN_DESCENT_DELTA = 0.001;
+        const IdxType SEMISORT_BUCKETS_PER_THREAD = 4;
 
         // for Unified Navigating Graph
         const IdxType NUM_ENTRY_POINTS = 16;
+        const IdxType ENTRY_POINT_SET_SIZE = 32;           // precomputed entry points per group, searches score a prefix
         const IdxType NUM_CROSS_EDGES = 6;
+        const IdxType PREFETCH_LOOKAHEAD = 4;
+        const IdxType CROSS_EDGE_CHUNK_SIZE = 64;
+        const IdxType CROSS_EDGE_POOL_FACTOR = 4;          // candidates per cross-group edge kept for pruning
+        const IdxType STREAM_CHUNK_SIZE = 65536;
     }
+
+
+    // optional construction strategies for the unified navigating graph
+    struct BuildOptions {
+        bool remap_labels = false;              // renumber labels by descending frequency, queries are remapped at search
+        bool batch_insert = false;              // link vamana graphs by exponentially growing batches without locks
+        bool nn_descent = false;                // init vamana graphs as NN-Descent kNN graphs refined by pruning
+        bool two_pass = false;                  // link vamana graphs twice, first with alpha=1 then with the target alpha
+        bool prune_cross_edges = false;         // keep a diverse subset of cross-group candidates by robust prune
+        uint32_t seed = default_paras::RANDOM_SEED;     // seed of the random insertion order
+
+        // if set, the base storage is filled from these files during the build, vectors are read in chunks straight
+        // into their group positions and each group graph is built once its vectors have arrived
+        std::string stream_bin_file, stream_label_file;
+
+        // with a memory budget in MB, groups are built in batches from a group-sorted copy of the vectors written to
+        // spill_prefix, where adjacency lists are also spilled, needs the stream files
+        float memory_budget_mb = 0;
+        std::string spill_prefix;
+    };
+
+    // optional query-time strategies for the unified navigating graph
+    struct SearchOptions {
+        IdxType entry_point_set_size = 0;       // entry points scored per entry group, 0 for num_entry_points
+        IdxType max_entry_groups = 0;           // only the closest entry groups seed the search, 0 for no limit
+        float group_size_weight = 0;            // favor larger groups when ranking entry groups, 0 for distance only
+        IdxType scan_threshold = 0;             // scan filters matching at most this many vectors, 0 to always use the graph
+        IdxType prefetch_lookahead = default_paras::PREFETCH_LOOKAHEAD;     // neighbors prefetched ahead during expansion
+        IdxType num_interleaved_queries = 1;    // queries kept in flight per thread to overlap memory stalls, 1 to disable
+        IdxType beam_width = 1;                 // latency mode: candidates expanded concurrently per step, 1 to disable
+        uint32_t num_beam_threads = 1;          // latency mode: threads sharing the expansion of a single query
+        IdxType patience = 0;                   // stop once the top-K are unchanged for this many expansions, 0 to disable
+        float distance_ratio = 0;               // stop once the closest unexpanded candidate is this many times farther
+                                                // than the K-th result, 0 to disable
+        float time_budget_ms = 0;               // stop a query after this much time and return its partial result, 0 for no limit
+        IdxType max_num_cmps = 0;               // stop a query after this many distance computations in the graph, 0 for no limit
+        IdxType budget_check_interval = 16;     // expansions between two reads of the clock
+        IdxType label_cache_capacity = 0;       // label sets whose entry groups are cached across queries, 0 to disable
+        bool group_by_label_set = false;        // batch mode: bucket queries by label set and resolve each bucket once
+    };
+
+    // per-query statistics of the graph search
+    struct QueryStats {
+        IdxType num_hops = 0;                   // candidates expanded
+        IdxType num_hops_saved = 0;             // candidates left unexpanded by early termination or budget
+        bool partial = false;                   // stopped by the time or distance computation budget
+    };
 }
 
 #endif // ANNS_CONFIG_H
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef FLAT_TRIE_H
+#define FLAT_TRIE_H
+
+#include <vector>
+#include <string>
+#include <limits>
+#include "config.h"
+#include "label_bitset.h"
+
+
+namespace ANNS {
+
+    // trie tree node stored in a flat table, nodes are referred to by their ids
+    struct FlatTrieNode {
+        LabelType label;
+        IdxType group_id;                       // group_id>0, and 0 if not a terminal node
+        LabelType label_set_size;               // number of elements in the label set if it is a terminal node
+        IdxType group_size;                     // number of elements in the group if it is a terminal node
+
+        IdxType parent;
+        IdxType child_offset;                   // children are a contiguous range in ascending label order
+        IdxType num_children;
+    };
+
+
+    // trie tree with the same semantics as TrieIndex, but kept in contiguous arrays
+    class FlatTrieIndex {
+
+        public:
+            static constexpr IdxType NONE = std::numeric_limits<IdxType>::max();
+
+            FlatTrieIndex();
+
+            // construction, count is the number of elements with this label set
+            IdxType insert(const std::vector<LabelType>& label_set, IdxType& new_label_set_id, IdxType count = 1);
+
+            // query, nodes are returned by id and NONE if not found
+            LabelType get_max_label_id() const { return _max_label_id; }
+            const FlatTrieNode& get_node(IdxType node_id) const { return _nodes[node_id]; }
+            const IdxType* get_children(IdxType node_id) const { return _child_ids.data() + _nodes[node_id].child_offset; }
+            IdxType find_exact_match(const std::vector<LabelType>& label_set) const;
+            void get_super_set_entrances(const std::vector<LabelType>& label_set,
+                                         std::vector<IdxType>& super_set_entrances,
+                                         bool avoid_self=false, bool need_containment=true) const;
+
+            // bitmaps of the labels on the path to each node, speeding up get_super_set_entrances for small
+            // label universes, rebuild after insertions
+            void build_path_bitsets();
+
+            // store the child ranges in node order without spare capacity, call after insertions
+            void compact_children();
+
+            // I/O, in the same file format as TrieIndex
+            void save(std::string filename) const;
+            void load(std::string filename);
+            float get_index_size();
+
+        private:
+            LabelType _max_label_id = 0;
+            IdxType _num_groups = 0;
+            std::vector<FlatTrieNode> _nodes;
+            std::vector<std::vector<IdxType>> _label_to_nodes;
+
+            // child ids and labels of all nodes, a child is looked up by binary search on the labels of the range of
+            // its parent, ranges are moved to the end with doubled capacity when they are full during insertions
+            std::vector<IdxType> _child_ids;
+            std::vector<LabelType> _child_labels;
+            std::vector<IdxType> _child_capacities;
+            IdxType get_child(IdxType parent, LabelType label) const;
+            void link_child(IdxType parent, IdxType child);
+
+            // labels on the path from the root to each node
+            LabelBitsets _path_bitsets;
+
+            // help function for get_super_set_entrances
+            bool examine_smallest(const std::vector<LabelType>& label_set, IdxType node_id) const;
+            bool examine_containment(const std::vector<LabelType>& label_set, IdxType node_id) const;
+    };
+}
+
+#endif // FLAT_TRIE_H
@@ -5,6 +5,7 @@
 #include <mutex>
 #include <fstream>
 #include <sstream>
+#include <xmmintrin.h>
 #include "config.h"
 
 
@@ -55,6 +56,18 @@ namespace ANNS {
                 in.close();
             }
 
+            // prefetch the neighbor list object of a node, and its neighbor ids once the object is cached
+            inline void prefetch_neighbors(IdxType idx) const {
+                _mm_prefetch((const char *)(neighbors + idx), _MM_HINT_T0);
+                _mm_prefetch((const char *)(neighbor_locks + idx), _MM_HINT_T0);
+            }
+
+            inline void prefetch_neighbor_ids(IdxType idx) const {
+                const auto& neighbor_list = neighbors[idx];
+                for (size_t b = 0; b < neighbor_list.size() * sizeof(IdxType); b += 64)
+                    _mm_prefetch((const char *)neighbor_list.data() + b, _MM_HINT_T0);
+            }
+
             float get_index_size() {
                 float index_size = 0;
                 for (IdxType i = 0; i < _num_points; i++)
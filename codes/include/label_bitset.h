@@ -0,0 +1,65 @@
+#ifndef LABEL_BITSET_H
+#define LABEL_BITSET_H
+
+#include <vector>
+#include <cstring>
+#include "config.h"
+
+
+namespace ANNS {
+
+    // label sets as fixed-width bitmaps stored contiguously, only enabled for small label universes
+    class LabelBitsets {
+
+        public:
+            static constexpr IdxType MAX_NUM_WORDS = 8;        // up to 512 labels
+
+            LabelBitsets() = default;
+
+            // enable bitmaps for num_sets label sets if all labels fit in the width
+            void init(LabelType max_label_id, IdxType num_sets) {
+                _num_words = (static_cast<IdxType>(max_label_id) + 64) / 64;
+                if (_num_words > MAX_NUM_WORDS)
+                    _num_words = 0;
+                _bits.assign(static_cast<size_t>(num_sets) * _num_words, 0);
+            }
+
+            void disable() { _num_words = 0; _bits.clear(); }
+            bool enabled() const { return _num_words > 0; }
+            IdxType num_words() const { return _num_words; }
+
+            uint64_t* get(IdxType id) { return _bits.data() + static_cast<size_t>(id) * _num_words; }
+            const uint64_t* get(IdxType id) const { return _bits.data() + static_cast<size_t>(id) * _num_words; }
+
+            // labels beyond the width are ignored, they cannot appear in any stored set
+            void encode(const std::vector<LabelType>& label_set, uint64_t* bits) const {
+                memset(bits, 0, _num_words * sizeof(uint64_t));
+                for (const auto& label : label_set)
+                    if (label / 64 < _num_words)
+                        bits[label / 64] |= 1ULL << (label % 64);
+            }
+
+            // whether a is a subset of b, written without early exit so that it vectorizes
+            bool is_subset(const uint64_t* a, const uint64_t* b) const {
+                uint64_t diff = 0;
+                for (IdxType i = 0; i < _num_words; ++i)
+                    diff |= a[i] & ~b[i];
+                return diff == 0;
+            }
+
+            bool intersects(const uint64_t* a, const uint64_t* b) const {
+                uint64_t common = 0;
+                for (IdxType i = 0; i < _num_words; ++i)
+                    common |= a[i] & b[i];
+                return common != 0;
+            }
+
+            float get_index_size() const { return _bits.size() * sizeof(uint64_t); }
+
+        private:
+            IdxType _num_words = 0;
+            std::vector<uint64_t> _bits;
+    };
+}
+
+#endif // LABEL_BITSET_H
@@ -0,0 +1,94 @@
+#ifndef LABEL_SET_CACHE_H
+#define LABEL_SET_CACHE_H
+
+#include <mutex>
+#include <list>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include "config.h"
+
+
+
+namespace ANNS {
+
+    struct LabelSetHash {
+        size_t operator()(const std::vector<LabelType>& label_set) const {
+            uint64_t hash = 14695981039346656037ULL;
+            for (const auto& label : label_set)
+                hash = (hash ^ label) * 1099511628211ULL;
+            return hash;
+        }
+    };
+
+
+    // concurrent cache from query label sets to their resolved entry groups, sharded to reduce lock contention,
+    // each shard evicts its least recently used entry once full
+    class LabelSetCache {
+        public:
+            static constexpr IdxType NUM_SHARDS = 16;
+
+            LabelSetCache() = default;
+
+            // capacity is the total number of cached label sets, 0 disables the cache
+            void init(IdxType capacity) {
+                _capacity_per_shard = (capacity + NUM_SHARDS - 1) / NUM_SHARDS;
+                for (auto& shard : _shards) {
+                    std::lock_guard<std::mutex> lock(shard.guard);
+                    shard.map.clear();
+                    shard.lru.clear();
+                }
+                _num_hits = 0;
+                _num_misses = 0;
+            }
+
+            bool enabled() const { return _capacity_per_shard > 0; }
+            uint64_t get_num_hits() const { return _num_hits; }
+            uint64_t get_num_misses() const { return _num_misses; }
+
+            bool get(const std::vector<LabelType>& label_set, std::vector<IdxType>& group_ids) {
+                auto hash = LabelSetHash()(label_set);
+                auto& shard = _shards[hash % NUM_SHARDS];
+                {
+                    std::lock_guard<std::mutex> lock(shard.guard);
+                    auto iter = shard.map.find(label_set);
+                    if (iter != shard.map.end()) {
+                        shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+                        group_ids = iter->second->second;
+                        _num_hits.fetch_add(1, std::memory_order_relaxed);
+                        return true;
+                    }
+                }
+                _num_misses.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            void put(const std::vector<LabelType>& label_set, const std::vector<IdxType>& group_ids) {
+                auto hash = LabelSetHash()(label_set);
+                auto& shard = _shards[hash % NUM_SHARDS];
+                std::lock_guard<std::mutex> lock(shard.guard);
+                if (shard.map.find(label_set) != shard.map.end())
+                    return;
+                shard.lru.emplace_front(label_set, group_ids);
+                shard.map.emplace(label_set, shard.lru.begin());
+                if (shard.lru.size() > _capacity_per_shard) {
+                    shard.map.erase(shard.lru.back().first);
+                    shard.lru.pop_back();
+                }
+            }
+
+        private:
+            // entries are kept from the most to the least recently used, the map points into the list
+            using Entry = std::pair<std::vector<LabelType>, std::vector<IdxType>>;
+            struct Shard {
+                std::mutex guard;
+                std::list<Entry> lru;
+                std::unordered_map<std::vector<LabelType>, std::list<Entry>::iterator, LabelSetHash> map;
+            };
+            Shard _shards[NUM_SHARDS];
+            IdxType _capacity_per_shard = 0;
+            std::atomic<uint64_t> _num_hits{0}, _num_misses{0};
+    };
+}
+
+#endif // LABEL_SET_CACHE_H
@@ -3,6 +3,7 @@
 
 #include <mutex>
 #include <deque>
+#include <chrono>
 #include "visited_set.h"
 #include "search_queue.h"
 
@@ -20,6 +21,30 @@ namespace ANNS {
             search_queue.reserve(search_queue_capacity);
             visited_set.init(visited_set_size);
         }
+
+        // time and distance computation budget of the current query, 0 for no limit
+        std::chrono::steady_clock::time_point deadline;
+        IdxType max_num_cmps = 0, num_cmps = 0;
+        bool has_deadline = false, out_of_budget = false;
+
+        void start_budget(float time_budget_ms, IdxType max_num_cmps) {
+            has_deadline = time_budget_ms > 0;
+            if (has_deadline)
+                deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<float, std::milli>(time_budget_ms));
+            this->max_num_cmps = max_num_cmps;
+            num_cmps = 0;
+            out_of_budget = false;
+        }
+
+        // charge distance computations to the budget, the clock is only read when asked
+        bool exceed_budget(IdxType new_cmps, bool check_time) {
+            num_cmps += new_cmps;
+            if ((max_num_cmps > 0 && num_cmps >= max_num_cmps) || 
+                (check_time && has_deadline && std::chrono::steady_clock::now() >= deadline))
+                out_of_budget = true;
+            return out_of_budget;
+        }
     };
 
 
@@ -46,6 +46,8 @@ namespace ANNS {
             // expand
             bool has_unexpanded_node() const { return _cur_unexpanded < _size; };
             const Candidate& get_closest_unexpanded();
+            const Candidate& peek_closest_unexpanded() const { return _data[_cur_unexpanded]; };
+            int32_t num_unexpanded() const;
             
         private:
 
@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <functional>
 #include <xmmintrin.h>
 #include <immintrin.h>
 #include "config.h"
@@ -18,13 +19,31 @@ namespace ANNS {
         public:
             virtual ~IStorage() = default;
 
+            // allocate an empty storage
+            virtual void init(IdxType num_points, IdxType dim) = 0;
+
             // I/O
             virtual void load_from_file(const std::string& bin_file, const std::string& label_file, 
                                         IdxType max_num_points = std::numeric_limits<IdxType>::max()) = 0;
             virtual void write_to_file(const std::string& bin_file, const std::string& label_file) = 0;
 
+            // streamed loading, label sets first with the vector memory allocated, then the vectors chunk by chunk
+            // into their new positions, on_chunk is called with the range of old ids of each chunk once it is written
+            virtual void load_label_sets_from_file(const std::string& bin_file, const std::string& label_file,
+                                                   bool allocate_vectors = true) = 0;
+            virtual void load_vectors_from_file(const std::string& bin_file, const std::vector<IdxType>& old_to_new_ids,
+                                                IdxType chunk_size, 
+                                                const std::function<void(IdxType, IdxType)>& on_chunk) = 0;
+
+            // out-of-core access, write the vectors of a file in a new order with one scan per batch of new ids,
+            // and fill an allocated storage with the vectors in [start, end) of a file
+            virtual void write_reordered_file(const std::string& bin_file, const std::string& reordered_bin_file,
+                                              const std::vector<IdxType>& old_to_new_ids, IdxType batch_size) = 0;
+            virtual void load_range_from_file(const std::string& bin_file, IdxType start, IdxType end) = 0;
+
             // reorder the vector data
             virtual void reorder_data(const std::vector<IdxType>& new_to_old_ids) = 0;
+            virtual void reorder_label_sets(const std::vector<IdxType>& new_to_old_ids) = 0;
 
             // get statistics
             virtual DataType get_data_type() const = 0;
@@ -40,6 +59,9 @@ namespace ANNS {
             // obtain a point cloest to the center
             virtual IdxType choose_medoid(uint32_t num_threads, std::shared_ptr<DistanceHandler> distance_handler) = 0;
 
+            // compute the center of vectors in [start, end), written in the data type of the storage
+            virtual void compute_centroid(IdxType start, IdxType end, char* centroid) const = 0;
+
             // clean
             virtual void clean() = 0;
     };
@@ -48,6 +70,7 @@ namespace ANNS {
     // obtain corresponding storage class
     std::shared_ptr<IStorage> create_storage(const std::string& data_type, bool verbose = true);
     std::shared_ptr<IStorage> create_storage(std::shared_ptr<IStorage> storage, IdxType start, IdxType end);
+    std::shared_ptr<IStorage> create_storage(DataType data_type, IdxType num_points, IdxType dim);
 
 
     // storage class
@@ -59,12 +82,27 @@ namespace ANNS {
             Storage(std::shared_ptr<IStorage> storage, IdxType start, IdxType end);
             ~Storage() = default;
 
+            // allocate an empty storage
+            void init(IdxType num_points, IdxType dim);
+
             // I/O
             void load_from_file(const std::string& bin_file, const std::string& label_file, IdxType max_num_points);
             void write_to_file(const std::string& bin_file, const std::string& label_file);
 
+            // streamed loading
+            void load_label_sets_from_file(const std::string& bin_file, const std::string& label_file,
+                                           bool allocate_vectors);
+            void load_vectors_from_file(const std::string& bin_file, const std::vector<IdxType>& old_to_new_ids,
+                                        IdxType chunk_size, const std::function<void(IdxType, IdxType)>& on_chunk);
+
+            // out-of-core access
+            void write_reordered_file(const std::string& bin_file, const std::string& reordered_bin_file,
+                                      const std::vector<IdxType>& old_to_new_ids, IdxType batch_size);
+            void load_range_from_file(const std::string& bin_file, IdxType start, IdxType end);
+
             // reorder the vector data
             void reorder_data(const std::vector<IdxType>& new_to_old_ids);
+            void reorder_label_sets(const std::vector<IdxType>& new_to_old_ids);
 
             // get statistics
             DataType get_data_type() const { return data_type; };
@@ -82,6 +120,9 @@ namespace ANNS {
             // obtain a point cloest to the center
             IdxType choose_medoid(uint32_t num_threads, std::shared_ptr<DistanceHandler> distance_handler);
 
+            // compute the center of vectors in [start, end)
+            void compute_centroid(IdxType start, IdxType end, char* centroid) const;
+
             // clean
             void clean() {
                 if (vecs)
@@ -96,6 +137,7 @@ namespace ANNS {
             T* vecs = nullptr;
             size_t prefetch_byte_num;
             std::vector<LabelType>* label_sets = nullptr;
+            IdxType load_label_sets(const std::string& label_file, IdxType max_num_points);
 
             // for logs
             bool verbose;
@@ -1,11 +1,12 @@
 #ifndef UNG_H
 #define UNG_H
 
-#include "trie.h"
+#include "flat_trie.h"
 #include "graph.h"
 #include "storage.h"
 #include "distance.h"
 #include "search_cache.h"
+#include "label_set_cache.h"
 #include "label_nav_graph.h"
 #include "vamana/vamana.h"
 
@@ -19,11 +20,26 @@ namespace ANNS {
 
             void build(std::shared_ptr<IStorage> base_storage, std::shared_ptr<DistanceHandler> distance_handler, 
                        std::string scenario, std::string index_name, uint32_t num_threads, IdxType num_cross_edges,
-                       IdxType max_degree, IdxType Lbuild, float alpha);
+                       IdxType max_degree, IdxType Lbuild, float alpha, const BuildOptions& options = BuildOptions());
             
             void search(std::shared_ptr<IStorage> query_storage, std::shared_ptr<DistanceHandler> distance_handler, 
                         uint32_t num_threads, IdxType Lsearch, IdxType num_entry_points, std::string scenario,
-                        IdxType K, std::pair<IdxType, float>* results, std::vector<float>& num_cmps);
+                        IdxType K, std::pair<IdxType, float>* results, std::vector<float>& num_cmps,
+                        const SearchOptions& options = SearchOptions(), 
+                        std::vector<QueryStats>* query_stats = nullptr);
+
+            // hits and misses of the label set cache since it was last reset
+            void get_label_cache_stats(uint64_t& num_hits, uint64_t& num_misses) const {
+                num_hits = _label_set_cache.get_num_hits();
+                num_misses = _label_set_cache.get_num_misses();
+            }
+
+            // entry groups of a label set as resolved at query time, and the label set of a group, for inspection
+            void get_entry_groups(const std::vector<LabelType>& label_set, const std::string& scenario,
+                                  std::vector<IdxType>& entry_group_ids);
+            const std::vector<LabelType>& get_group_label_set(IdxType group_id) const { 
+                return _group_id_to_label_set[group_id]; 
+            }
 
             // I/O
             void save(std::string index_path_prefix);
@@ -37,31 +53,72 @@ namespace ANNS {
             std::shared_ptr<Graph> _graph;
             IdxType _num_points;
 
+            // label dictionary, frequent labels get small ids for a better trie shape
+            std::vector<LabelType> _label_map;              // original to new label ids, empty if not remapped
+            LabelType _unknown_label = 0;                   // new id of labels never seen at build, matching no group
+            std::vector<std::vector<LabelType>> _remapped_query_label_sets;
+            void remap_base_labels();
+            void remap_query_labels();
+            const std::vector<LabelType>& get_query_label_set(IdxType query_id) {
+                return _label_map.empty() ? _query_storage->get_label_set(query_id) : _remapped_query_label_sets[query_id];
+            }
+
             // trie index and vector groups
             IdxType _num_groups;
-            TrieIndex _trie_index;
+            FlatTrieIndex _trie_index;
             std::vector<IdxType> _new_vec_id_to_group_id;
             std::vector<std::vector<IdxType>> _group_id_to_vec_ids;
             std::vector<std::vector<LabelType>> _group_id_to_label_set;
             void build_trie_and_divide_groups();
 
+            // label set of each group as a bitmap, for small label universes
+            LabelBitsets _group_label_bitsets;
+            void build_label_bitsets();
+
             // label navigating graph
             std::shared_ptr<LabelNavGraph> _label_nav_graph = nullptr;
             void get_min_super_sets(const std::vector<LabelType>& query_label_set, std::vector<IdxType>& min_super_set_ids, 
                                     bool avoid_self=false, bool need_containment=true);
             void build_label_nav_graph();
 
+            // query-time resolution of entry groups with the label navigating graph
+            std::vector<IdxType> _root_group_ids;
+            void compute_root_group_ids();
+            void get_entry_group_ids(IdxType query_id, std::vector<IdxType>& entry_group_ids);
+            void resolve_entry_group_ids(const std::vector<LabelType>& query_label_set, 
+                                         std::vector<IdxType>& entry_group_ids);
+
+            // entry groups of hot label sets, shared by all search threads
+            LabelSetCache _label_set_cache;
+            IdxType _label_cache_capacity = 0;
+            std::string _label_cache_scenario;
+
+            // batch mode, queries bucketed by label set with the entry groups resolved once per bucket
+            std::vector<IdxType> _query_order, _query_bucket_ids;
+            std::vector<std::vector<IdxType>> _bucket_entry_group_ids;
+            void bucket_queries_by_label_set(uint32_t num_threads);
+
             // prepare vector storage for each group
             std::vector<IdxType> _new_to_old_vec_ids;
             std::vector<std::pair<IdxType, IdxType>> _group_id_to_range;
             std::vector<std::shared_ptr<IStorage>> _group_storages;
             void prepare_group_storages_graphs();
 
+            // centroid of each group for ranking entry groups
+            std::shared_ptr<IStorage> _group_centroids;
+            void compute_group_centroids();
+
             // graph indices for each graph
             std::string _index_name;
             std::vector<std::shared_ptr<Graph>> _group_graphs;
             std::vector<IdxType> _group_entry_points;
+            std::vector<std::vector<IdxType>> _group_entry_point_sets;
+            uint32_t schedule_group_builds(std::vector<IdxType>& group_order, std::vector<uint32_t>& group_num_threads);
+            void build_group_graph(IdxType group_id, uint32_t num_threads);
             void build_graph_for_all_groups();
+            void stream_vectors_and_build_graphs(const std::string& bin_file);
+            void compute_group_entry_point_sets();
+            void compute_group_entry_point_set(IdxType group_id);
             void build_complete_graph(std::shared_ptr<Graph> graph, IdxType num_points);
             std::vector<std::shared_ptr<Vamana>> _vamana_instances;
 
@@ -70,25 +127,66 @@ namespace ANNS {
             float _alpha;
             uint32_t _num_threads;
             std::string _scenario;
+            BuildOptions _build_options;
+
+            // out-of-core build within a memory budget, groups are processed in batches of consecutive ids, with their
+            // vectors read from a group-sorted file and their adjacency lists spilled to disk in between
+            bool _out_of_core = false;
+            std::string _sorted_bin_file, _spilled_graph_file;
+            std::vector<uint64_t> _group_spill_offsets;
+            uint64_t get_group_footprint(IdxType group_id) const;
+            void get_group_batches(const std::vector<IdxType>& group_ids, uint64_t budget, 
+                                   std::vector<std::vector<IdxType>>& batches) const;
+            void load_group(IdxType group_id, bool with_graph);
+            void release_group(IdxType group_id, bool keep_vectors);
+            void build_graphs_out_of_core();
+            void load_spilled_graph();
+            void visit_group_pairs(const std::vector<std::vector<IdxType>>& out_group_ids, IdxType chunk_size,
+                                   const std::function<void(IdxType, IdxType, IdxType)>& visit);
 
             // cross-group edges
             IdxType _num_cross_edges;
-            std::vector<SearchQueue> _cross_group_neighbors;
             void build_cross_group_edges();
 
             // obtain the final unified navigating graph
             void add_offset_for_uni_nav_graph();
 
             // obtain entry_points
-            std::vector<IdxType> get_entry_points(const std::vector<LabelType>& query_label_set, 
-                                                  IdxType num_entry_points, VisitedSet& visited_set);
-            void get_entry_points_given_group_id(IdxType num_entry_points, VisitedSet& visited_set, 
-                                                 IdxType group_id, std::vector<IdxType>& entry_points);
+            IdxType seed_entry_points(IdxType query_id, IdxType num_entry_points, const SearchOptions& options,
+                                      std::shared_ptr<SearchCache> search_cache);
+            IdxType seed_entry_points_given_group_id(const char* query, IdxType num_entry_points, IdxType group_id,
+                                                     std::shared_ptr<SearchCache> search_cache);
+            IdxType rank_entry_groups(const char* query, std::vector<IdxType>& entry_group_ids, 
+                                      const SearchOptions& options);
+
+            // exhaustive search for very selective filters
+            bool get_matching_groups(const std::vector<LabelType>& query_label_set, IdxType max_num_points,
+                                     std::vector<IdxType>& matching_group_ids);
+            IdxType scan_groups(const char* query, const std::vector<IdxType>& group_ids, SearchQueue& result);
 
             // search in graph
             IdxType iterate_to_fixed_point(const char* query, std::shared_ptr<SearchCache> search_cache, 
                                            IdxType target_id, const std::vector<IdxType>& entry_points,
-                                           bool clear_search_queue=true, bool clear_visited_set=true);
+                                           const SearchOptions& options, bool clear_search_queue=true, 
+                                           bool clear_visited_set=true, QueryStats* stats=nullptr);
+            IdxType expand_beam_to_fixed_point(const char* query, std::shared_ptr<SearchCache> search_cache,
+                                               const SearchOptions& options, QueryStats* stats);
+            bool terminate_early(const SearchQueue& search_queue, const SearchOptions& options, 
+                                 IdxType& num_stable, float& kth_distance);
+            IdxType _K;
+            IdxType _entry_point_set_size = 0;
+            uint32_t _num_beam_threads = 1;
+
+            // interleaved search that keeps several queries in flight per thread
+            void search_interleaved(uint32_t num_threads, IdxType Lsearch, IdxType num_entry_points, IdxType K,
+                                    std::pair<IdxType, float>* results, std::vector<float>& num_cmps,
+                                    const SearchOptions& options, std::vector<QueryStats>* query_stats);
+            bool start_query(IdxType query_id, IdxType num_entry_points, IdxType K, const SearchOptions& options,
+                             std::shared_ptr<SearchCache> search_cache, bool& multi_group,
+                             std::vector<IdxType>& entry_group_ids, SearchQueue& cur_result,
+                             std::pair<IdxType, float>* results, std::vector<float>& num_cmps);
+            void write_results(IdxType query_id, IdxType K, const SearchQueue& cur_result, 
+                               std::pair<IdxType, float>* results);
 
             // statistics
             float _index_time, _label_processing_time, _build_graph_time;
@@ -39,6 +39,11 @@ namespace ANNS {
                 return _marks[idx] == _curValue; 
             }
 
+            // mark as visited and return whether it had been visited, safe for threads sharing the set
+            inline bool check_and_set_atomic(IdxType idx) {
+                return __atomic_exchange_n(_marks + idx, _curValue, __ATOMIC_RELAXED) == _curValue;
+            }
+
             ~VisitedSet() { 
                 delete[] _marks; 
             }
@@ -0,0 +1,329 @@
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include "flat_trie.h"
+
+
+namespace ANNS {
+
+    FlatTrieIndex::FlatTrieIndex() {
+        _nodes.push_back({0, 0, 0, 0, NONE, 0, 0});
+        _child_capacities.push_back(0);
+    }
+
+
+    // find the child of a node with the given label
+    IdxType FlatTrieIndex::get_child(IdxType parent, LabelType label) const {
+        const auto& node = _nodes[parent];
+        auto begin = _child_labels.begin() + node.child_offset;
+        auto end = begin + node.num_children;
+        auto iter = std::lower_bound(begin, end, label);
+        if (iter == end || *iter != label)
+            return NONE;
+        return _child_ids[node.child_offset + (iter - begin)];
+    }
+
+
+    // insert a node into the child range of its parent, keeping ascending label order
+    void FlatTrieIndex::link_child(IdxType parent, IdxType child) {
+        auto& node = _nodes[parent];
+        auto label = _nodes[child].label;
+
+        // a full range is moved to the end with doubled capacity
+        if (node.num_children == _child_capacities[parent]) {
+            IdxType capacity = std::max<IdxType>(2, 2 * _child_capacities[parent]);
+            IdxType offset = _child_ids.size();
+            _child_ids.resize(offset + capacity, NONE);
+            _child_labels.resize(offset + capacity, 0);
+            std::copy_n(_child_ids.begin() + node.child_offset, node.num_children, _child_ids.begin() + offset);
+            std::copy_n(_child_labels.begin() + node.child_offset, node.num_children, _child_labels.begin() + offset);
+            node.child_offset = offset;
+            _child_capacities[parent] = capacity;
+        }
+
+        // shift the larger labels to make room
+        auto begin = _child_labels.begin() + node.child_offset;
+        IdxType pos = std::lower_bound(begin, begin + node.num_children, label) - begin;
+        for (IdxType i = node.num_children; i > pos; --i) {
+            _child_ids[node.child_offset + i] = _child_ids[node.child_offset + i - 1];
+            _child_labels[node.child_offset + i] = _child_labels[node.child_offset + i - 1];
+        }
+        _child_ids[node.child_offset + pos] = child;
+        _child_labels[node.child_offset + pos] = label;
+        node.num_children += 1;
+    }
+
+
+    void FlatTrieIndex::compact_children() {
+        std::vector<IdxType> child_ids;
+        std::vector<LabelType> child_labels;
+        child_ids.reserve(_nodes.size());
+        child_labels.reserve(_nodes.size());
+        for (IdxType id = 0; id < _nodes.size(); ++id) {
+            auto& node = _nodes[id];
+            IdxType offset = child_ids.size();
+            child_ids.insert(child_ids.end(), _child_ids.begin() + node.child_offset,
+                             _child_ids.begin() + node.child_offset + node.num_children);
+            child_labels.insert(child_labels.end(), _child_labels.begin() + node.child_offset,
+                                _child_labels.begin() + node.child_offset + node.num_children);
+            node.child_offset = offset;
+            _child_capacities[id] = node.num_children;
+        }
+        _child_ids.swap(child_ids);
+        _child_labels.swap(child_labels);
+    }
+
+
+    // insert a new label set into the trie tree, increase the group size
+    IdxType FlatTrieIndex::insert(const std::vector<LabelType>& label_set, IdxType& new_label_set_id, IdxType count) {
+        _path_bitsets.disable();
+        IdxType cur = 0;
+        for (const LabelType label : label_set) {
+            IdxType child = get_child(cur, label);
+
+            // create a new node
+            if (child == NONE) {
+                child = _nodes.size();
+                _nodes.push_back({label, 0, 0, 0, cur, 0, 0});
+                _child_capacities.push_back(0);
+                link_child(cur, child);
+
+                // update max label id and label_to_nodes
+                if (label >= _max_label_id) {
+                    _max_label_id = label;
+                    _label_to_nodes.resize(_max_label_id+1);
+                }
+                _label_to_nodes[label].push_back(child);
+            }
+            cur = child;
+        }
+
+        // set the group_id and group_size
+        auto& node = _nodes[cur];
+        if (node.group_id == 0) {
+            node.group_id = new_label_set_id++;
+            node.label_set_size = label_set.size();
+            node.group_size = count;
+            _num_groups = std::max(_num_groups, node.group_id);
+        } else {
+            node.group_size += count;
+        }
+        return node.group_id;
+    }
+
+
+    // find the exact match of the label set
+    IdxType FlatTrieIndex::find_exact_match(const std::vector<LabelType>& label_set) const {
+        IdxType cur = 0;
+        for (const LabelType label : label_set) {
+            cur = get_child(cur, label);
+            if (cur == NONE)
+                return NONE;
+        }
+
+        // check whether it is a terminal node
+        if (_nodes[cur].group_id == 0)
+            return NONE;
+        return cur;
+    }
+
+
+    // get the top entrances of all super sets in the trie tree, assume the label_set has been sorted in ascending order
+    void FlatTrieIndex::get_super_set_entrances(const std::vector<LabelType>& label_set,
+                                                std::vector<IdxType>& super_set_entrances,
+                                                bool avoid_self, bool need_containment) const {
+        super_set_entrances.clear();
+
+        // find the existing node for the input label set
+        IdxType avoided_node = NONE;
+        if (avoid_self)
+            avoided_node = find_exact_match(label_set);
+        std::vector<IdxType> q;
+
+        // bitmap of the query labels
+        uint64_t query_bits[LabelBitsets::MAX_NUM_WORDS];
+        bool use_bitsets = _path_bitsets.enabled();
+        if (use_bitsets)
+            _path_bitsets.encode(label_set, query_bits);
+
+        // if the label set is empty, find all children of the root
+        if (label_set.empty()) {
+            q.insert(q.end(), get_children(0), get_children(0) + _nodes[0].num_children);
+        } else {
+
+            // if need containing the input label set, obtain candidate nodes for the last label
+            if (need_containment) {
+                if (label_set.back() < _label_to_nodes.size())
+                    for (auto node : _label_to_nodes[label_set.back()])
+                        if (use_bitsets ? _path_bitsets.is_subset(query_bits, _path_bitsets.get(node)) 
+                                        : examine_containment(label_set, node))
+                            q.push_back(node);
+
+            // if no need for containing the whole label set
+            } else {
+                for (auto label : label_set)
+                    if (label < _label_to_nodes.size())
+                        for (auto node : _label_to_nodes[label])
+                            if (use_bitsets ? !_path_bitsets.intersects(query_bits, _path_bitsets.get(_nodes[node].parent))
+                                            : examine_smallest(label_set, node))
+                                q.push_back(node);
+            }
+        }
+
+        // search in the trie tree to find the candidate super sets, the vector serves as a fifo queue, the marks
+        // of found groups are kept per thread and reset through the found entrances, so no call pays for all groups
+        static thread_local std::vector<bool> found_groups;
+        if (found_groups.size() < _num_groups+1)
+            found_groups.resize(_num_groups+1, false);
+        for (size_t head = 0; head < q.size(); ++head) {
+            const auto& cur = _nodes[q[head]];
+
+            // add to candidates if it is a terminal node
+            if (cur.group_id > 0 && q[head] != avoided_node && !found_groups[cur.group_id]) {
+                found_groups[cur.group_id] = true;
+                super_set_entrances.push_back(q[head]);
+            } else {
+                q.insert(q.end(), get_children(q[head]), get_children(q[head]) + cur.num_children);
+            }
+        }
+        for (auto node : super_set_entrances)
+            found_groups[_nodes[node].group_id] = false;
+    }
+
+
+    // top to bottom, the path bitmap of a node is the one of its parent plus its own label
+    void FlatTrieIndex::build_path_bitsets() {
+        _path_bitsets.init(_max_label_id, _nodes.size());
+        if (!_path_bitsets.enabled())
+            return;
+        std::vector<IdxType> stack = {0};
+        while (!stack.empty()) {
+            auto cur = stack.back();
+            stack.pop_back();
+            for (IdxType i = 0; i < _nodes[cur].num_children; ++i) {
+                auto child = get_children(cur)[i];
+                memcpy(_path_bitsets.get(child), _path_bitsets.get(cur), _path_bitsets.num_words() * sizeof(uint64_t));
+                _path_bitsets.get(child)[_nodes[child].label / 64] |= 1ULL << (_nodes[child].label % 64);
+                stack.push_back(child);
+            }
+        }
+    }
+
+
+    // bottom to top, examine whether the current node is the smallest in the label set
+    bool FlatTrieIndex::examine_smallest(const std::vector<LabelType>& label_set, IdxType node_id) const {
+        auto cur = _nodes[node_id].parent;
+        while (cur != NONE && _nodes[cur].label >= label_set[0]) {
+            if (std::binary_search(label_set.begin(), label_set.end(), _nodes[cur].label))
+                return false;
+            cur = _nodes[cur].parent;
+        }
+        return true;
+    }
+
+
+    // bottom to top, examine whether is a super set of the label set
+    bool FlatTrieIndex::examine_containment(const std::vector<LabelType>& label_set, IdxType node_id) const {
+        auto cur = _nodes[node_id].parent;
+        for (int64_t i = label_set.size()-2; i>=0; --i) {
+            while (_nodes[cur].label > label_set[i] && _nodes[cur].parent != NONE)
+                cur = _nodes[cur].parent;
+            if (_nodes[cur].parent == NONE || _nodes[cur].label != label_set[i])
+                return false;
+        }
+        return true;
+    }
+
+
+    // save the trie tree to a file
+    void FlatTrieIndex::save(std::string filename) const {
+        std::ofstream out(filename);
+
+        // save the max label id and number of nodes
+        out << _max_label_id << std::endl;
+        out << _nodes.size() << std::endl;
+
+        // save the nodes
+        for (IdxType id = 0; id < _nodes.size(); ++id) {
+            const auto& node = _nodes[id];
+            out << id << " " << node.label << " " << node.group_id << " " \
+                << node.label_set_size << " " << node.group_size << std::endl;
+        }
+
+        // save the parent of each node
+        for (IdxType id = 0; id < _nodes.size(); ++id)
+            out << id << " " << (id == 0 ? 0 : _nodes[id].parent) << std::endl;
+
+        // save the children of each node
+        for (IdxType id = 0; id < _nodes.size(); ++id) {
+            out << id << " " << _nodes[id].num_children << " ";
+            for (IdxType i = 0; i < _nodes[id].num_children; ++i)
+                out << _nodes[get_children(id)[i]].label << " " << get_children(id)[i] << " ";
+            out << std::endl;
+        }
+    }
+
+
+    // load the trie tree from a file, node ids may come in any order
+    void FlatTrieIndex::load(std::string filename) {
+        std::ifstream in(filename);
+        if (!in.is_open()) {
+            std::cerr << "Error: cannot open file " << filename << std::endl;
+            exit(-1);
+        }
+        LabelType label, label_set_size;
+        IdxType id, group_id, group_size, parent_id, child_id, num_children;
+
+        // load the max label id and number of nodes
+        in >> _max_label_id;
+        IdxType num_nodes;
+        in >> num_nodes;
+
+        // load the nodes
+        _nodes.assign(num_nodes, {0, 0, 0, 0, NONE, 0, 0});
+        _child_capacities.assign(num_nodes, 0);
+        _num_groups = 0;
+        for (IdxType i=0; i<num_nodes; ++i) {
+            in >> id >> label >> group_id >> label_set_size >> group_size;
+            _nodes[id] = {label, group_id, label_set_size, group_size, NONE, 0, 0};
+            _num_groups = std::max(_num_groups, group_id);
+        }
+
+        // load the parent of each node
+        for (IdxType i=0; i<num_nodes; ++i) {
+            in >> id >> parent_id;
+            if (id > 0)
+                _nodes[id].parent = parent_id;
+        }
+
+        // load the children of each node
+        _child_ids.clear();
+        _child_labels.clear();
+        for (IdxType i=0; i<num_nodes; ++i) {
+            in >> id >> num_children;
+            for (IdxType j=0; j<num_children; ++j) {
+                in >> label >> child_id;
+                link_child(id, child_id);
+            }
+        }
+        compact_children();
+
+        // build label_to_nodes
+        _label_to_nodes.clear();
+        _label_to_nodes.resize(_max_label_id+1);
+        for (IdxType id=1; id<num_nodes; ++id)
+            _label_to_nodes[_nodes[id].label].push_back(id);
+        build_path_bitsets();
+    }
+
+
+
+    float FlatTrieIndex::get_index_size() {
+        float index_size = _nodes.size() * sizeof(FlatTrieNode);
+        for (const auto& nodes : _label_to_nodes)
+            index_size += nodes.size() * sizeof(IdxType);
+        index_size += _child_ids.size() * (sizeof(IdxType) + sizeof(LabelType));
+        index_size += _path_bitsets.get_index_size();
+        return index_size;
+    }
+}
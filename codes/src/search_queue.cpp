@@ -61,4 +61,14 @@ namespace ANNS {
             _cur_unexpanded++;
         return _data[pre];
     }
+
+
+    // number of candidates not expanded yet
+    int32_t SearchQueue::num_unexpanded() const {
+        int32_t num = 0;
+        for (auto i = _cur_unexpanded; i < _size; ++i)
+            if (!_data[i].expanded)
+                num++;
+        return num;
+    }
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <omp.h>
 #include <fstream>
 #include <string>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <sstream>
@@ -49,6 +50,24 @@ namespace ANNS {
     }
     
 
+    // obtain an empty storage with allocated memory
+    std::shared_ptr<IStorage> create_storage(DataType data_type, IdxType num_points, IdxType dim) {
+        std::shared_ptr<IStorage> storage;
+        if (data_type == DataType::FLOAT) 
+            storage = std::make_shared<Storage<float>>(data_type, false);
+        else if (data_type == DataType::INT8)
+            storage = std::make_shared<Storage<int8_t>>(data_type, false);
+        else if (data_type == DataType::UINT8)
+            storage = std::make_shared<Storage<uint8_t>>(data_type, false);
+        else {
+            std::cerr << "Error: invalid data type " << data_type << std::endl;
+            exit(-1);
+        }
+        storage->init(num_points, dim);
+        return storage;
+    }
+    
+
     // construct the class
     template<typename T>
     Storage<T>::Storage(DataType data_type, bool verbose) {
@@ -72,6 +91,20 @@ namespace ANNS {
 
     
 
+    // allocate zero vectors and empty label sets
+    template<typename T>
+    void Storage<T>::init(IdxType num_points, IdxType dim) {
+        this->num_points = num_points;
+        this->dim = dim;
+        std::uint64_t alloc_size = static_cast<std::uint64_t>(num_points) * static_cast<std::uint64_t>(dim) * static_cast<std::uint64_t>(sizeof(T));
+        vecs = static_cast<T*>(std::aligned_alloc(32, alloc_size));
+        std::memset(vecs, 0, alloc_size);
+        label_sets = new std::vector<LabelType>[num_points];
+        prefetch_byte_num = dim * sizeof(T);
+    }
+
+
+
     // load data
     template<typename T>
     void Storage<T>::load_from_file(const std::string& bin_file, const std::string& label_file, IdxType max_num_points) {
@@ -100,9 +133,27 @@ namespace ANNS {
         prefetch_byte_num = dim * sizeof(T);
 
         // read label data if exists
+        auto num_labels = load_label_sets(label_file, max_num_points);
+
+        // statistics
+        if (verbose) {
+            std::cout << "- Number of points: " << num_points << std::endl;
+            std::cout << "- Dimension: " << dim << std::endl;
+            std::cout << "- Number of labels: " << num_labels << std::endl;
+            std::cout << "- Time: " << std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::high_resolution_clock::now() - start_time).count() << " ms" << std::endl;
+            std::cout << SEP_LINE;
+        }
+    }
+
+
+
+    // read the label sets of the first num_points points, return the number of distinct labels
+    template<typename T>
+    IdxType Storage<T>::load_label_sets(const std::string& label_file, IdxType max_num_points) {
         std::map<LabelType, IdxType> label_cnts;
         label_sets = new std::vector<LabelType>[num_points];
-        file.open(label_file);
+        std::ifstream file(label_file);
         if (file.is_open()) {
             std::string line, label;
             for (auto i=0; i<num_points && i<max_num_points; ++i) {
@@ -122,17 +173,43 @@ namespace ANNS {
 
         // unfiltered ANNS when label file not found 
         } else {
-            std::cout << "- Warning: label file not found, set all labels to 1" << std::endl;
+            if (verbose)
+                std::cout << "- Warning: label file not found, set all labels to 1" << std::endl;
             for (auto i=0; i<num_points && i<max_num_points; ++i)
                 label_sets[i] = {1};
             label_cnts[1] = num_points;
         }
+        return label_cnts.size();
+    }
+
+
+
+    // read the header and the label sets, vectors are left for load_vectors_from_file
+    template<typename T>
+    void Storage<T>::load_label_sets_from_file(const std::string& bin_file, const std::string& label_file,
+                                               bool allocate_vectors) {
+        if (verbose)
+            std::cout << "Loading label sets from " << label_file << " ..." << std::endl;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        std::ifstream file(bin_file, std::ios::binary);
+        if (!file.is_open())
+            throw std::runtime_error("Failed to open file: " + bin_file);
+        file.read((char *)&num_points, sizeof(IdxType));
+        file.read((char *)&dim, sizeof(IdxType));
+        file.close();
+
+        if (allocate_vectors) {
+            std::uint64_t alloc_size = static_cast<std::uint64_t>(num_points) * static_cast<std::uint64_t>(dim) * static_cast<std::uint64_t>(sizeof(T));
+            vecs = static_cast<T*>(std::aligned_alloc(32, alloc_size));
+        }
+        prefetch_byte_num = dim * sizeof(T);
+        auto num_labels = load_label_sets(label_file, num_points);
 
         // statistics
         if (verbose) {
             std::cout << "- Number of points: " << num_points << std::endl;
             std::cout << "- Dimension: " << dim << std::endl;
-            std::cout << "- Number of labels: " << label_cnts.size() << std::endl;
+            std::cout << "- Number of labels: " << num_labels << std::endl;
             std::cout << "- Time: " << std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::high_resolution_clock::now() - start_time).count() << " ms" << std::endl;
             std::cout << SEP_LINE;
@@ -141,18 +218,141 @@ namespace ANNS {
 
 
 
+    // read the vectors chunk by chunk and scatter them to their new positions
+    template<typename T>
+    void Storage<T>::load_vectors_from_file(const std::string& bin_file, const std::vector<IdxType>& old_to_new_ids,
+                                            IdxType chunk_size, const std::function<void(IdxType, IdxType)>& on_chunk) {
+        std::ifstream file(bin_file, std::ios::binary);
+        if (!file.is_open())
+            throw std::runtime_error("Failed to open file: " + bin_file);
+        file.seekg(2 * sizeof(IdxType), std::ios::beg);
+        std::vector<T> chunk(static_cast<std::uint64_t>(chunk_size) * dim);
+        for (IdxType start=0; start<num_points; start+=chunk_size) {
+            IdxType end = std::min<uint64_t>(static_cast<uint64_t>(start) + chunk_size, num_points);
+            file.read((char *)chunk.data(), static_cast<std::streamsize>(end - start) * dim * sizeof(T));
+            for (auto i=start; i<end; ++i)
+                std::memcpy(vecs + static_cast<std::uint64_t>(old_to_new_ids[i]) * dim, 
+                            chunk.data() + static_cast<std::uint64_t>(i - start) * dim, dim * sizeof(T));
+            on_chunk(start, end);
+        }
+        file.close();
+    }
+
+
+
+    // external permutation in two passes, the input is scattered into one run per batch of new ids in a temporary
+    // file, then each run is read back, put in order in memory and appended to the output
+    template<typename T>
+    void Storage<T>::write_reordered_file(const std::string& bin_file, const std::string& reordered_bin_file,
+                                          const std::vector<IdxType>& old_to_new_ids, IdxType batch_size) {
+        std::ifstream in(bin_file, std::ios::binary);
+        if (!in.is_open())
+            throw std::runtime_error("Failed to open file: " + bin_file);
+        std::string runs_file = reordered_bin_file + ".runs";
+        const std::uint64_t vec_size = static_cast<std::uint64_t>(dim) * sizeof(T);
+        const std::uint64_t record_size = sizeof(IdxType) + vec_size;
+        const IdxType chunk_size = default_paras::STREAM_CHUNK_SIZE;
+        IdxType num_batches = (static_cast<std::uint64_t>(num_points) + batch_size - 1) / batch_size;
+
+        // scatter the vectors tagged with their new ids, each run buffers its share of a chunk and is flushed to
+        // its own region of the temporary file
+        std::ofstream runs_out(runs_file, std::ios::binary);
+        IdxType buffer_size = std::max<IdxType>(1, chunk_size / num_batches);
+        std::vector<char> buffers(static_cast<std::uint64_t>(num_batches) * buffer_size * record_size);
+        std::vector<IdxType> num_buffered(num_batches, 0);
+        std::vector<std::uint64_t> num_flushed(num_batches, 0);
+        auto flush = [&](IdxType batch_id) {
+            runs_out.seekp((static_cast<std::uint64_t>(batch_id) * batch_size + num_flushed[batch_id]) * record_size);
+            runs_out.write(buffers.data() + static_cast<std::uint64_t>(batch_id) * buffer_size * record_size,
+                           static_cast<std::streamsize>(num_buffered[batch_id] * record_size));
+            num_flushed[batch_id] += num_buffered[batch_id];
+            num_buffered[batch_id] = 0;
+        };
+        std::vector<char> chunk(static_cast<std::uint64_t>(chunk_size) * record_size);
+        in.seekg(2 * sizeof(IdxType), std::ios::beg);
+        for (IdxType start=0; start<num_points; start+=chunk_size) {
+            IdxType end = std::min<std::uint64_t>(static_cast<std::uint64_t>(start) + chunk_size, num_points);
+            in.read(chunk.data(), static_cast<std::streamsize>((end - start) * vec_size));
+            for (auto i=start; i<end; ++i) {
+                IdxType new_id = old_to_new_ids[i];
+                IdxType batch_id = new_id / batch_size;
+                char* record = buffers.data() + (static_cast<std::uint64_t>(batch_id) * buffer_size 
+                                                 + num_buffered[batch_id]) * record_size;
+                std::memcpy(record, &new_id, sizeof(IdxType));
+                std::memcpy(record + sizeof(IdxType), chunk.data() + (i - start) * vec_size, vec_size);
+                if (++num_buffered[batch_id] == buffer_size)
+                    flush(batch_id);
+            }
+        }
+        for (IdxType batch_id=0; batch_id<num_batches; ++batch_id)
+            if (num_buffered[batch_id] > 0)
+                flush(batch_id);
+        in.close();
+        runs_out.close();
+        buffers = std::vector<char>();
+
+        // gather each run in order of new ids, runs are stored in order of batches so they are read sequentially
+        std::ifstream runs_in(runs_file, std::ios::binary);
+        std::ofstream out(reordered_bin_file, std::ios::binary);
+        out.write((char *)&num_points, sizeof(IdxType));
+        out.write((char *)&dim, sizeof(IdxType));
+        std::vector<T> batch(static_cast<std::uint64_t>(batch_size) * dim);
+        for (IdxType batch_start=0; batch_start<num_points; batch_start+=batch_size) {
+            IdxType batch_end = std::min<std::uint64_t>(static_cast<std::uint64_t>(batch_start) + batch_size, num_points);
+            for (IdxType start=batch_start; start<batch_end; start+=chunk_size) {
+                IdxType end = std::min<std::uint64_t>(static_cast<std::uint64_t>(start) + chunk_size, batch_end);
+                runs_in.read(chunk.data(), static_cast<std::streamsize>((end - start) * record_size));
+                for (IdxType i=0; i<end-start; ++i) {
+                    IdxType new_id;
+                    std::memcpy(&new_id, chunk.data() + i * record_size, sizeof(IdxType));
+                    std::memcpy(batch.data() + static_cast<std::uint64_t>(new_id - batch_start) * dim,
+                                chunk.data() + i * record_size + sizeof(IdxType), vec_size);
+                }
+            }
+            out.write((char *)batch.data(), static_cast<std::streamsize>(batch_end - batch_start) * vec_size);
+        }
+        runs_in.close();
+        out.close();
+        std::remove(runs_file.c_str());
+    }
+
+
+
+    // fill an allocated storage of end-start points with the vectors in [start, end) of a file
+    template<typename T>
+    void Storage<T>::load_range_from_file(const std::string& bin_file, IdxType start, IdxType end) {
+        std::ifstream file(bin_file, std::ios::binary);
+        if (!file.is_open())
+            throw std::runtime_error("Failed to open file: " + bin_file);
+        if (end - start != num_points) {
+            std::cerr << "Error: storage of " << num_points << " points cannot hold range [" << start << ", " 
+                      << end << ")" << std::endl;
+            exit(-1);
+        }
+        file.seekg(2 * sizeof(IdxType) + static_cast<std::uint64_t>(start) * dim * sizeof(T), std::ios::beg);
+        file.read((char *)vecs, static_cast<std::streamsize>(num_points) * dim * sizeof(T));
+        file.close();
+    }
+
+
+
     // write data
     template<typename T>
     void Storage<T>::write_to_file(const std::string& bin_file, const std::string& label_file) {
 
         // write vector data
-        std::ofstream file(bin_file, std::ios::binary);
-        file.write((char *)&num_points, sizeof(IdxType));
-        file.write((char *)&dim, sizeof(IdxType));
-        file.write((char *)vecs, num_points * dim * sizeof(T));
-        file.close();
+        std::ofstream file;
+        if (!bin_file.empty()) {
+            file.open(bin_file, std::ios::binary);
+            file.write((char *)&num_points, sizeof(IdxType));
+            file.write((char *)&dim, sizeof(IdxType));
+            file.write((char *)vecs, num_points * dim * sizeof(T));
+            file.close();
+        }
 
         // write label data
+        if (label_file.empty())
+            return;
         file.open(label_file);
         for (auto i=0; i<num_points; ++i) {
             file << label_sets[i][0];
@@ -174,12 +374,13 @@ namespace ANNS {
 		std::uint64_t alloc_size = static_cast<std::uint64_t>(num_points) * static_cast<std::uint64_t>(dim) * static_cast<std::uint64_t>(sizeof(T));
         auto new_vecs = static_cast<T*>(std::aligned_alloc(32, alloc_size));
         auto new_label_sets = new std::vector<LabelType>[num_points];
+        #pragma omp parallel for schedule(static, 4096)
         for (auto i=0; i<num_points; ++i) {
 			std::uint64_t offset_dst = static_cast<std::uint64_t>(i) * dim;
 			std::uint64_t offset_src = static_cast<std::uint64_t>(new_to_old_ids[i]) * dim;
 			std::size_t copy_bytes = static_cast<std::uint64_t>(dim) * sizeof(T);
 			std::memcpy(new_vecs + offset_dst, vecs + offset_src, copy_bytes);
-            new_label_sets[i] = label_sets[new_to_old_ids[i]];
+            new_label_sets[i] = std::move(label_sets[new_to_old_ids[i]]);
         }
         // clean up
         delete[] vecs;
@@ -190,6 +391,19 @@ namespace ANNS {
 
 
 
+    // reorder the label sets only
+    template<typename T>
+    void Storage<T>::reorder_label_sets(const std::vector<IdxType>& new_to_old_ids) {
+        auto new_label_sets = new std::vector<LabelType>[num_points];
+        #pragma omp parallel for schedule(static, 4096)
+        for (auto i=0; i<num_points; ++i)
+            new_label_sets[i] = std::move(label_sets[new_to_old_ids[i]]);
+        delete[] label_sets;
+        label_sets = new_label_sets;
+    }
+
+
+
     // obtain a point cloest to the center
     template<typename T>
     IdxType Storage<T>::choose_medoid(uint32_t num_threads, std::shared_ptr<DistanceHandler> distance_handler) {
@@ -214,4 +428,18 @@ namespace ANNS {
         delete[] center;
         return medoid;
     }
+
+
+
+    // compute the center of vectors in [start, end)
+    template<typename T>
+    void Storage<T>::compute_centroid(IdxType start, IdxType end, char* centroid) const {
+        std::vector<double> sum(dim, 0);
+        for (auto id=start; id<end; ++id) 
+            for (auto d=0; d<dim; ++d)
+                sum[d] += *(vecs + static_cast<std::uint64_t>(id) * dim + d);
+        T* center = reinterpret_cast<T*>(centroid);
+        for (auto d=0; d<dim; ++d)
+            center[d] = static_cast<T>(sum[d] / std::max<IdxType>(end - start, 1));
+    }
 }
@@ -1,5 +1,10 @@
 #include <omp.h>
+#include <queue>
+#include <atomic>
 #include <iostream>
+#include <cmath>
+#include <limits>
+#include <random>
 #include <algorithm>
 #include <unordered_set>
 #include <boost/filesystem.hpp>
@@ -15,9 +20,21 @@ namespace ANNS {
 
     void UniNavGraph::build(std::shared_ptr<IStorage> base_storage, std::shared_ptr<DistanceHandler> distance_handler, 
                             std::string scenario, std::string index_name, uint32_t num_threads, IdxType num_cross_edges,
-                            IdxType max_degree, IdxType Lbuild, float alpha) {
+                            IdxType max_degree, IdxType Lbuild, float alpha, const BuildOptions& options) {
         auto all_start_time = std::chrono::high_resolution_clock::now();
         _base_storage = base_storage;
+        bool streaming = !options.stream_bin_file.empty();
+        _out_of_core = options.memory_budget_mb > 0;
+        if (_out_of_core && (!streaming || options.spill_prefix.empty())) {
+            std::cerr << "Error: a memory budget needs the input files and a spill prefix" << std::endl;
+            exit(-1);
+        }
+        if (_out_of_core && options.prune_cross_edges) {
+            std::cerr << "Error: pruning cross-group edges needs all vectors in memory, not a memory budget" << std::endl;
+            exit(-1);
+        }
+        if (streaming)
+            _base_storage->load_label_sets_from_file(options.stream_bin_file, options.stream_label_file, !_out_of_core);
         _num_points = base_storage->get_num_points();
         _distance_handler = distance_handler;
         std::cout << "- Scenario: " << scenario << std::endl;
@@ -30,22 +47,38 @@ namespace ANNS {
         _alpha = alpha;
         _num_threads = num_threads;
         _scenario = scenario;
+        _build_options = options;
 
         // build the trie tree index to divide groups
         std::cout << "Dividing groups and building the trie tree index ..." << std::endl;
         auto start_time = std::chrono::high_resolution_clock::now();
+        _label_map.clear();
+        if (options.remap_labels)
+            remap_base_labels();
         build_trie_and_divide_groups();
         _graph = std::make_shared<ANNS::Graph>(base_storage->get_num_points());
         prepare_group_storages_graphs();
+        if (!streaming)
+            compute_group_centroids();
         _label_processing_time = std::chrono::duration_cast<std::chrono::milliseconds>(
                                  std::chrono::high_resolution_clock::now() - start_time).count();
         std::cout << "- Finished in " << _label_processing_time << " ms" << std::endl;
 
-        // build graph index for each group
-        build_graph_for_all_groups();
+        // build graph index for each group, overlapped with loading the vectors when streaming
+        if (_out_of_core) {
+            build_graphs_out_of_core();
+        } else {
+            if (streaming)
+                stream_vectors_and_build_graphs(options.stream_bin_file);
+            else
+                build_graph_for_all_groups();
+            compute_group_entry_point_sets();
+        }
 
         // for label equality scenario, there is no need for label navigating graph and cross-group edges
         if (_scenario == "equality") {
+            if (_out_of_core)
+                load_spilled_graph();
             add_offset_for_uni_nav_graph();
         } else {
 
@@ -65,24 +98,139 @@ namespace ANNS {
 
     void UniNavGraph::build_trie_and_divide_groups() {
 
-        // create groups for base label sets
+        // each thread deduplicates the label sets of a contiguous range of points, in order of first occurrence
+        uint32_t num_threads = std::max<uint32_t>(1, std::min<uint64_t>(_num_threads, _num_points / 4096 + 1));
+        std::vector<std::vector<const std::vector<LabelType>*>> local_label_sets(num_threads);
+        std::vector<std::vector<IdxType>> local_group_sizes(num_threads);
+        std::vector<IdxType> local_ids(_num_points);
+        #pragma omp parallel for num_threads(num_threads) schedule(static, 1)
+        for (uint32_t t=0; t<num_threads; ++t) {
+            std::unordered_map<std::vector<LabelType>, IdxType, LabelSetHash> label_set_to_local_id;
+            IdxType start = static_cast<uint64_t>(_num_points) * t / num_threads;
+            IdxType end = static_cast<uint64_t>(_num_points) * (t+1) / num_threads;
+            for (IdxType vec_id=start; vec_id<end; ++vec_id) {
+                const auto& label_set = _base_storage->get_label_set(vec_id);
+
+                // the label set is only copied as a key the first time it is seen
+                auto iter = label_set_to_local_id.find(label_set);
+                if (iter == label_set_to_local_id.end()) {
+                    iter = label_set_to_local_id.emplace(label_set, local_label_sets[t].size()).first;
+                    local_label_sets[t].push_back(&label_set);
+                    local_group_sizes[t].push_back(0);
+                }
+                local_ids[vec_id] = iter->second;
+                local_group_sizes[t][iter->second]++;
+            }
+        }
+
+        // merge in thread order so that group ids follow the first occurrence, only unique sets enter the trie
         IdxType new_group_id = 1;
-        for (auto vec_id=0; vec_id<_num_points; ++vec_id) {
-            const auto& label_set = _base_storage->get_label_set(vec_id);
-            auto group_id = _trie_index.insert(label_set, new_group_id);
+        std::vector<std::vector<IdxType>> local_to_group_ids(num_threads);
+        std::vector<IdxType> group_sizes(1, 0);
+        for (uint32_t t=0; t<num_threads; ++t) {
+            for (IdxType local_id=0; local_id<local_label_sets[t].size(); ++local_id) {
+                const auto& label_set = *local_label_sets[t][local_id];
+                auto group_id = _trie_index.insert(label_set, new_group_id, local_group_sizes[t][local_id]);
+                if (group_id+1 > _group_id_to_label_set.size()) {
+                    _group_id_to_label_set.resize(group_id+1);
+                    _group_id_to_label_set[group_id] = label_set;
+                    group_sizes.resize(group_id+1, 0);
+                }
+                local_to_group_ids[t].push_back(group_id);
 
-            // deal with new label set
-            if (group_id+1 > _group_id_to_vec_ids.size()) {
-                _group_id_to_vec_ids.resize(group_id+1);
-                _group_id_to_label_set.resize(group_id+1);
-                _group_id_to_label_set[group_id] = label_set;
+                // offset of the thread inside the group
+                auto num_earlier = group_sizes[group_id];
+                group_sizes[group_id] += local_group_sizes[t][local_id];
+                local_group_sizes[t][local_id] = num_earlier;
+            }
+        }
+
+        // each thread scatters its points to their groups, keeping ascending ids within each group
+        _group_id_to_vec_ids.resize(group_sizes.size());
+        for (IdxType group_id=1; group_id<group_sizes.size(); ++group_id)
+            _group_id_to_vec_ids[group_id].resize(group_sizes[group_id]);
+        #pragma omp parallel for num_threads(num_threads) schedule(static, 1)
+        for (uint32_t t=0; t<num_threads; ++t) {
+            IdxType start = static_cast<uint64_t>(_num_points) * t / num_threads;
+            IdxType end = static_cast<uint64_t>(_num_points) * (t+1) / num_threads;
+            auto& offsets = local_group_sizes[t];
+            for (IdxType vec_id=start; vec_id<end; ++vec_id) {
+                auto local_id = local_ids[vec_id];
+                _group_id_to_vec_ids[local_to_group_ids[t][local_id]][offsets[local_id]++] = vec_id;
             }
-            _group_id_to_vec_ids[group_id].emplace_back(vec_id);
         }
 
         // logs
         _num_groups = new_group_id-1;
         std::cout << "- Number of groups: " << _num_groups << std::endl;    
+        build_label_bitsets();
+    }
+
+
+
+    // renumber labels by descending frequency, starting from 1
+    void UniNavGraph::remap_base_labels() {
+
+        // count label frequencies
+        std::vector<IdxType> label_freqs;
+        for (IdxType vec_id=0; vec_id<_num_points; ++vec_id)
+            for (const auto& label : _base_storage->get_label_set(vec_id)) {
+                if (label >= label_freqs.size())
+                    label_freqs.resize(label+1, 0);
+                label_freqs[label]++;
+            }
+
+        // sort labels, ties are broken by the original id
+        std::vector<LabelType> labels;
+        for (IdxType label=0; label<label_freqs.size(); ++label)
+            if (label_freqs[label] > 0)
+                labels.emplace_back(label);
+        std::stable_sort(labels.begin(), labels.end(), [&](LabelType a, LabelType b) {
+            return label_freqs[a] > label_freqs[b];
+        });
+        _label_map.assign(label_freqs.size(), 0);
+        for (IdxType i=0; i<labels.size(); ++i)
+            _label_map[labels[i]] = i+1;
+        _unknown_label = labels.size()+1;
+
+        // rewrite the base label sets, keeping them sorted
+        #pragma omp parallel for num_threads(_num_threads) schedule(static, 4096)
+        for (IdxType vec_id=0; vec_id<_num_points; ++vec_id) {
+            auto& label_set = _base_storage->get_label_set(vec_id);
+            for (auto& label : label_set)
+                label = _label_map[label];
+            std::sort(label_set.begin(), label_set.end());
+        }
+        std::cout << "- Remapped " << labels.size() << " labels by frequency" << std::endl;
+    }
+
+
+
+    // map query labels into the build-time dictionary, labels never seen at build match no group
+    void UniNavGraph::remap_query_labels() {
+        IdxType num_queries = _query_storage->get_num_points();
+        _remapped_query_label_sets.resize(num_queries);
+        for (IdxType query_id=0; query_id<num_queries; ++query_id) {
+            auto& label_set = _remapped_query_label_sets[query_id];
+            label_set.clear();
+            for (const auto& label : _query_storage->get_label_set(query_id))
+                label_set.emplace_back(label < _label_map.size() && _label_map[label] > 0 ? _label_map[label] : _unknown_label);
+            std::sort(label_set.begin(), label_set.end());
+            label_set.erase(std::unique(label_set.begin(), label_set.end()), label_set.end());
+        }
+    }
+
+
+
+    // bitmaps of the group label sets and of the trie paths, left disabled for large label universes
+    void UniNavGraph::build_label_bitsets() {
+        _trie_index.compact_children();
+        _trie_index.build_path_bitsets();
+        _group_label_bitsets.init(_trie_index.get_max_label_id(), _num_groups+1);
+        if (!_group_label_bitsets.enabled())
+            return;
+        for (IdxType group_id=1; group_id<=_num_groups; ++group_id)
+            _group_label_bitsets.encode(_group_id_to_label_set[group_id], _group_label_bitsets.get(group_id));
     }
             
 
@@ -92,35 +240,43 @@ namespace ANNS {
         min_super_set_ids.clear();
 
         // obtain the candidates
-        std::vector<std::shared_ptr<TrieNode>> candidates;
+        std::vector<IdxType> candidates;
         _trie_index.get_super_set_entrances(query_label_set, candidates, avoid_self, need_containment);
 
         // special cases
         if (candidates.empty())
             return;
         if (candidates.size() == 1) {
-            min_super_set_ids.emplace_back(candidates[0]->group_id);
+            min_super_set_ids.emplace_back(_trie_index.get_node(candidates[0]).group_id);
             return;
         }
 
         // obtain the minimum size
         std::sort(candidates.begin(), candidates.end(), 
-                  [](const std::shared_ptr<TrieNode>& a, const std::shared_ptr<TrieNode>& b) {
-                      return a->label_set_size < b->label_set_size;
+                  [&](IdxType a, IdxType b) {
+                      return _trie_index.get_node(a).label_set_size < _trie_index.get_node(b).label_set_size;
                   });
-        auto min_size = _group_id_to_label_set[candidates[0]->group_id].size();
+        auto min_size = _group_id_to_label_set[_trie_index.get_node(candidates[0]).group_id].size();
         
         // get the minimum super sets
         for (auto candidate : candidates) {
-            const auto& cur_group_id = candidate->group_id;
+            const auto& cur_group_id = _trie_index.get_node(candidate).group_id;
             const auto& cur_label_set = _group_id_to_label_set[cur_group_id];
             bool is_min = true;
             
             // check whether contains existing minimum super sets (label ids are in ascending order)
             if (cur_label_set.size() > min_size) {
                 for (auto min_group_id : min_super_set_ids) {
-                    const auto& min_label_set = _group_id_to_label_set[min_group_id];
-                    if (std::includes(cur_label_set.begin(), cur_label_set.end(), min_label_set.begin(), min_label_set.end())) {
+                    bool contained;
+                    if (_group_label_bitsets.enabled()) {
+                        contained = _group_label_bitsets.is_subset(_group_label_bitsets.get(min_group_id), 
+                                                                   _group_label_bitsets.get(cur_group_id));
+                    } else {
+                        const auto& min_label_set = _group_id_to_label_set[min_group_id];
+                        contained = std::includes(cur_label_set.begin(), cur_label_set.end(), 
+                                                  min_label_set.begin(), min_label_set.end());
+                    }
+                    if (contained) {
                         is_min = false;
                         break;
                     }
@@ -144,16 +300,25 @@ namespace ANNS {
         IdxType new_vec_id = 0;
         for (auto group_id=1; group_id<=_num_groups; ++group_id) {
             _group_id_to_range[group_id].first = new_vec_id;
+            new_vec_id += _group_id_to_vec_ids[group_id].size();
+            _group_id_to_range[group_id].second = new_vec_id;
+        }
+        omp_set_num_threads(_num_threads);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (auto group_id=1; group_id<=_num_groups; ++group_id) {
+            auto new_vec_id = _group_id_to_range[group_id].first;
             for (auto old_vec_id : _group_id_to_vec_ids[group_id]) {
                 _new_to_old_vec_ids[new_vec_id] = old_vec_id;
                 _new_vec_id_to_group_id[new_vec_id] = group_id;
                 ++new_vec_id;
             }
-            _group_id_to_range[group_id].second = new_vec_id;
         }
 
-        // reorder the underlying storage
-        _base_storage->reorder_data(_new_to_old_vec_ids);
+        // reorder the underlying storage, streamed vectors are written in place later
+        if (_build_options.stream_bin_file.empty())
+            _base_storage->reorder_data(_new_to_old_vec_ids);
+        else
+            _base_storage->reorder_label_sets(_new_to_old_vec_ids);
 
         // init storage and graph for each group
         _group_storages.resize(_num_groups + 1);
@@ -161,13 +326,75 @@ namespace ANNS {
         for (auto group_id=1; group_id<=_num_groups; ++group_id) {
             auto start = _group_id_to_range[group_id].first;
             auto end = _group_id_to_range[group_id].second;
-            _group_storages[group_id] = create_storage(_base_storage, start, end);
+            if (!_out_of_core)
+                _group_storages[group_id] = create_storage(_base_storage, start, end);
             _group_graphs[group_id] = std::make_shared<Graph>(_graph, start, end);
         }
     }
 
 
 
+    void UniNavGraph::compute_group_centroids() {
+        _group_centroids = create_storage(_base_storage->get_data_type(), _num_groups+1, _base_storage->get_dim());
+        omp_set_num_threads(_num_threads);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (auto group_id=1; group_id<=_num_groups; ++group_id) {
+            const auto& range = _group_id_to_range[group_id];
+            _base_storage->compute_centroid(range.first, range.second, _group_centroids->get_vector(group_id));
+        }
+    }
+
+
+
+    // largest of the given groups first, a group larger than the share of one thread is built by a proportional number
+    // of threads, while the remaining threads take the small groups, return the number of outer threads
+    uint32_t UniNavGraph::schedule_group_builds(std::vector<IdxType>& group_order, 
+                                                std::vector<uint32_t>& group_num_threads) {
+        group_num_threads.assign(_num_groups + 1, 1);
+        uint64_t num_points = 0;
+        for (auto group_id : group_order)
+            num_points += _group_id_to_vec_ids[group_id].size();
+        std::stable_sort(group_order.begin(), group_order.end(), [&](IdxType a, IdxType b) {
+            return _group_id_to_vec_ids[a].size() > _group_id_to_vec_ids[b].size();
+        });
+        uint32_t num_large_groups = 0, num_large_group_threads = 0;
+        for (auto group_id : group_order) {
+            uint64_t group_size = _group_id_to_vec_ids[group_id].size();
+            if (group_size * _num_threads <= num_points || num_large_group_threads == _num_threads)
+                break;
+            group_num_threads[group_id] = std::min<uint32_t>((group_size * _num_threads + num_points / 2) / num_points,
+                                                             _num_threads - num_large_group_threads);
+            num_large_groups++;
+            num_large_group_threads += group_num_threads[group_id];
+        }
+        return num_large_groups + (_num_threads - num_large_group_threads);
+    }
+
+
+
+    void UniNavGraph::build_group_graph(IdxType group_id, uint32_t num_threads) {
+                
+        // if there are less than _max_degree points in the group, just build a complete graph
+        const auto& range = _group_id_to_range[group_id];
+        if (range.second - range.first <= _max_degree) {
+            build_complete_graph(_group_graphs[group_id], range.second - range.first);
+            _vamana_instances[group_id] = std::make_shared<Vamana>(_group_storages[group_id], _distance_handler,
+                                                                   _group_graphs[group_id], 0);
+
+        // build the vamana graph
+        } else {                
+            _vamana_instances[group_id] = std::make_shared<Vamana>(false);
+            _vamana_instances[group_id]->build(_group_storages[group_id], _distance_handler, 
+                                               _group_graphs[group_id], _max_degree, _Lbuild, _alpha, 
+                                               num_threads, default_paras::MAX_CANDIDATE_SIZE, _build_options);
+        }
+
+        // set entry point
+        _group_entry_points[group_id] = _vamana_instances[group_id]->get_entry_point() + range.first;
+    }
+
+
+
     void UniNavGraph::build_graph_for_all_groups() {
         std::cout << "Building graph for each group ..." << std::endl;
         omp_set_num_threads(_num_threads);
@@ -177,29 +404,22 @@ namespace ANNS {
         if (_index_name == "Vamana") {
             _vamana_instances.resize(_num_groups + 1);
             _group_entry_points.resize(_num_groups + 1);
-
-            #pragma omp parallel for schedule(dynamic, 1)
-            for (auto group_id=1; group_id<=_num_groups; ++group_id) {
-                if (group_id % 100 == 0)
-                    std::cout << "\r" << (100.0 * group_id) / _num_groups << "%" << std::flush;
-                
-                // if there are less than _max_degree points in the group, just build a complete graph
-                const auto& range = _group_id_to_range[group_id];
-                if (range.second - range.first <= _max_degree) {
-                    build_complete_graph(_group_graphs[group_id], range.second - range.first);
-                    _vamana_instances[group_id] = std::make_shared<Vamana>(_group_storages[group_id], _distance_handler,
-                                                                           _group_graphs[group_id], 0);
-
-                // build the vamana graph
-                } else {                
-                    _vamana_instances[group_id] = std::make_shared<Vamana>(false);
-                    _vamana_instances[group_id]->build(_group_storages[group_id], _distance_handler, 
-                                                       _group_graphs[group_id], _max_degree, _Lbuild, _alpha, 1);
-                }
-
-                // set entry point
-                _group_entry_points[group_id] = _vamana_instances[group_id]->get_entry_point() + range.first;
+            std::vector<IdxType> group_order(_num_groups);
+            std::vector<uint32_t> group_num_threads;
+            for (IdxType i=0; i<_num_groups; ++i)
+                group_order[i] = i+1;
+            uint32_t num_outer_threads = schedule_group_builds(group_order, group_num_threads);
+
+            // large groups are built by nested teams, the previous nesting level is restored afterwards
+            int max_active_levels = omp_get_max_active_levels();
+            omp_set_max_active_levels(std::max(max_active_levels, 2));
+            #pragma omp parallel for schedule(dynamic, 1) num_threads(num_outer_threads)
+            for (IdxType i=0; i<_num_groups; ++i) {
+                if (i % 100 == 0)
+                    std::cout << "\r" << (100.0 * i) / _num_groups << "%" << std::flush;
+                build_group_graph(group_order[i], group_num_threads[group_order[i]]);
             }
+            omp_set_max_active_levels(max_active_levels);
         
         // if none of the above
         } else {
@@ -214,6 +434,287 @@ namespace ANNS {
 
 
 
+    // read the vectors chunk by chunk straight into their reordered positions, and start building the centroid and
+    // the graph of a group as soon as all its vectors have arrived
+    void UniNavGraph::stream_vectors_and_build_graphs(const std::string& bin_file) {
+        std::cout << "Streaming vectors and building graph for each group ..." << std::endl;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        if (_index_name != "Vamana") {
+            std::cerr << "Error: invalid index name " << _index_name << std::endl;
+            exit(-1);
+        }
+        _vamana_instances.resize(_num_groups + 1);
+        _group_entry_points.resize(_num_groups + 1);
+        _group_centroids = create_storage(_base_storage->get_data_type(), _num_groups+1, _base_storage->get_dim());
+        std::vector<IdxType> group_order(_num_groups);
+        std::vector<uint32_t> group_num_threads;
+        for (IdxType i=0; i<_num_groups; ++i)
+            group_order[i] = i+1;
+        uint32_t num_outer_threads = schedule_group_builds(group_order, group_num_threads);
+
+        // number of vectors still missing in each group
+        std::vector<IdxType> old_to_new_vec_ids(_num_points), num_missing(_num_groups + 1);
+        for (IdxType new_vec_id=0; new_vec_id<_num_points; ++new_vec_id)
+            old_to_new_vec_ids[_new_to_old_vec_ids[new_vec_id]] = new_vec_id;
+        for (IdxType group_id=1; group_id<=_num_groups; ++group_id)
+            num_missing[group_id] = _group_id_to_vec_ids[group_id].size();
+
+        // one thread reads and spawns a task per completed group, the others run the tasks with the same thread
+        // shares as the regular path
+        IdxType num_built_groups = 0;
+        int max_active_levels = omp_get_max_active_levels();
+        omp_set_max_active_levels(std::max(max_active_levels, 2));
+        #pragma omp parallel num_threads(num_outer_threads + 1)
+        #pragma omp single
+        {
+            _base_storage->load_vectors_from_file(bin_file, old_to_new_vec_ids, default_paras::STREAM_CHUNK_SIZE, 
+                                                  [&](IdxType start, IdxType end) {
+                for (IdxType old_vec_id=start; old_vec_id<end; ++old_vec_id) {
+                    auto group_id = _new_vec_id_to_group_id[old_to_new_vec_ids[old_vec_id]];
+                    if (--num_missing[group_id] > 0)
+                        continue;
+                    if (num_built_groups++ % 100 == 0)
+                        std::cout << "\r" << (100.0 * num_built_groups) / _num_groups << "%" << std::flush;
+                    #pragma omp task firstprivate(group_id)
+                    {
+                        const auto& range = _group_id_to_range[group_id];
+                        _base_storage->compute_centroid(range.first, range.second, _group_centroids->get_vector(group_id));
+                        build_group_graph(group_id, group_num_threads[group_id]);
+                    }
+                }
+            });
+        }
+        omp_set_max_active_levels(max_active_levels);
+
+        _build_graph_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::high_resolution_clock::now() - start_time).count();
+        std::cout << "\r- Finished in " << _build_graph_time << " ms" << std::endl;
+    }
+
+
+
+    // memory of a group while resident, its vectors plus adjacency lists at full slack
+    uint64_t UniNavGraph::get_group_footprint(IdxType group_id) const {
+        uint64_t vec_size = _base_storage->get_dim() * (_base_storage->get_data_type() == DataType::FLOAT ? sizeof(float) 
+                                                                                                          : sizeof(uint8_t));
+        uint64_t adjacency_size = sizeof(std::vector<IdxType>) 
+                                + default_paras::GRAPH_SLACK_FACTOR * _max_degree * sizeof(IdxType);
+        return _group_id_to_vec_ids[group_id].size() * (vec_size + adjacency_size);
+    }
+
+
+
+    // split groups into consecutive batches fitting the budget, a group larger than the budget forms its own batch,
+    // and all groups form one batch without a budget
+    void UniNavGraph::get_group_batches(const std::vector<IdxType>& group_ids, uint64_t budget, 
+                                        std::vector<std::vector<IdxType>>& batches) const {
+        batches.clear();
+        uint64_t batch_footprint = 0;
+        for (auto group_id : group_ids) {
+            auto footprint = get_group_footprint(group_id);
+            if (batches.empty() || (budget > 0 && batch_footprint + footprint > budget && !batches.back().empty())) {
+                batches.emplace_back();
+                batch_footprint = 0;
+            }
+            batches.back().push_back(group_id);
+            batch_footprint += footprint;
+        }
+    }
+
+
+
+    // bring the vectors of a group, and optionally its spilled graph, into memory
+    void UniNavGraph::load_group(IdxType group_id, bool with_graph) {
+        const auto& range = _group_id_to_range[group_id];
+        if (_group_storages[group_id] == nullptr) {
+            _group_storages[group_id] = create_storage(_base_storage->get_data_type(), range.second - range.first, 
+                                                       _base_storage->get_dim());
+            _group_storages[group_id]->load_range_from_file(_sorted_bin_file, range.first, range.second);
+        }
+        if (with_graph && _vamana_instances[group_id] == nullptr) {
+            std::ifstream in(_spilled_graph_file, std::ios::binary);
+            in.seekg(_group_spill_offsets[group_id], std::ios::beg);
+            IdxType degree;
+            for (auto vec_id=range.first; vec_id<range.second; ++vec_id) {
+                in.read((char *)&degree, sizeof(IdxType));
+                _graph->neighbors[vec_id].resize(degree);
+                in.read((char *)_graph->neighbors[vec_id].data(), degree * sizeof(IdxType));
+            }
+            _vamana_instances[group_id] = std::make_shared<Vamana>(_group_storages[group_id], _distance_handler, 
+                                                                   _group_graphs[group_id], 
+                                                                   _group_entry_points[group_id] - range.first);
+        }
+    }
+
+
+
+    void UniNavGraph::release_group(IdxType group_id, bool keep_vectors) {
+        const auto& range = _group_id_to_range[group_id];
+        _vamana_instances[group_id] = nullptr;
+        for (auto vec_id=range.first; vec_id<range.second; ++vec_id)
+            std::vector<IdxType>().swap(_graph->neighbors[vec_id]);
+        if (!keep_vectors && _group_storages[group_id] != nullptr) {
+            _group_storages[group_id]->clean();
+            _group_storages[group_id] = nullptr;
+        }
+    }
+
+
+
+    // write the vectors in group order to disk, then build the groups batch by batch within the memory budget,
+    // spilling the adjacency lists of each batch before loading the next one
+    void UniNavGraph::build_graphs_out_of_core() {
+        std::cout << "Building graph for each group within " << _build_options.memory_budget_mb << " MB ..." << std::endl;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        if (_index_name != "Vamana") {
+            std::cerr << "Error: invalid index name " << _index_name << std::endl;
+            exit(-1);
+        }
+        uint64_t budget = _build_options.memory_budget_mb * 1024 * 1024;
+        fs::create_directories(_build_options.spill_prefix);
+        _sorted_bin_file = _build_options.spill_prefix + "vecs.bin";
+        _spilled_graph_file = _build_options.spill_prefix + "graph.spill";
+        _vamana_instances.assign(_num_groups + 1, nullptr);
+        _group_entry_points.resize(_num_groups + 1);
+        _group_entry_point_sets.clear();
+        _group_entry_point_sets.resize(_num_groups + 1);
+        _group_centroids = create_storage(_base_storage->get_data_type(), _num_groups+1, _base_storage->get_dim());
+
+        // group-sorted vector file
+        std::vector<IdxType> old_to_new_vec_ids(_num_points);
+        for (IdxType new_vec_id=0; new_vec_id<_num_points; ++new_vec_id)
+            old_to_new_vec_ids[_new_to_old_vec_ids[new_vec_id]] = new_vec_id;
+        uint64_t vec_size = get_group_footprint(_new_vec_id_to_group_id[0]) / _group_id_to_vec_ids[_new_vec_id_to_group_id[0]].size();
+        IdxType batch_size = std::max<uint64_t>(1, std::min<uint64_t>(budget / vec_size, _num_points));
+        _base_storage->write_reordered_file(_build_options.stream_bin_file, _sorted_bin_file, old_to_new_vec_ids, batch_size);
+
+        // build batch by batch, adjacency lists are spilled in group order with local ids
+        std::vector<IdxType> group_ids(_num_groups);
+        for (IdxType i=0; i<_num_groups; ++i)
+            group_ids[i] = i+1;
+        std::vector<std::vector<IdxType>> batches;
+        get_group_batches(group_ids, budget, batches);
+        _group_spill_offsets.assign(_num_groups + 1, 0);
+        std::ofstream spill(_spilled_graph_file, std::ios::binary);
+        int max_active_levels = omp_get_max_active_levels();
+        omp_set_max_active_levels(std::max(max_active_levels, 2));
+        for (size_t batch_id=0; batch_id<batches.size(); ++batch_id) {
+            auto group_order = batches[batch_id];
+            std::cout << "\r" << (100.0 * batch_id) / batches.size() << "%" << std::flush;
+            for (auto group_id : group_order)
+                load_group(group_id, false);
+
+            std::vector<uint32_t> group_num_threads;
+            uint32_t num_outer_threads = schedule_group_builds(group_order, group_num_threads);
+            #pragma omp parallel for schedule(dynamic, 1) num_threads(num_outer_threads)
+            for (IdxType i=0; i<group_order.size(); ++i)
+                build_group_graph(group_order[i], group_num_threads[group_order[i]]);
+
+            #pragma omp parallel for schedule(dynamic, 1) num_threads(_num_threads)
+            for (IdxType i=0; i<group_order.size(); ++i) {
+                auto group_id = group_order[i];
+                const auto& range = _group_id_to_range[group_id];
+                _group_storages[group_id]->compute_centroid(0, range.second - range.first, 
+                                                           _group_centroids->get_vector(group_id));
+                compute_group_entry_point_set(group_id);
+            }
+
+            for (auto group_id : batches[batch_id]) {
+                const auto& range = _group_id_to_range[group_id];
+                _group_spill_offsets[group_id] = spill.tellp();
+                for (auto vec_id=range.first; vec_id<range.second; ++vec_id) {
+                    IdxType degree = _graph->neighbors[vec_id].size();
+                    spill.write((char *)&degree, sizeof(IdxType));
+                    spill.write((char *)_graph->neighbors[vec_id].data(), degree * sizeof(IdxType));
+                }
+                release_group(group_id, false);
+            }
+        }
+        omp_set_max_active_levels(max_active_levels);
+        spill.close();
+
+        _build_graph_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::high_resolution_clock::now() - start_time).count();
+        std::cout << "\r- Finished in " << _build_graph_time << " ms with " << batches.size() << " batches" << std::endl;
+    }
+
+
+
+    // read all spilled adjacency lists back once the group graphs are no longer searched
+    void UniNavGraph::load_spilled_graph() {
+        std::ifstream in(_spilled_graph_file, std::ios::binary);
+        IdxType degree;
+        for (IdxType vec_id=0; vec_id<_num_points; ++vec_id) {
+            in.read((char *)&degree, sizeof(IdxType));
+            _graph->neighbors[vec_id].resize(degree);
+            in.read((char *)_graph->neighbors[vec_id].data(), degree * sizeof(IdxType));
+        }
+        in.close();
+        fs::remove(_spilled_graph_file);
+    }
+
+
+
+    // call visit(group_id, start, end) on chunks of the vectors of each group while its listed out groups are resident,
+    // within the memory budget groups and out groups are brought in by batches, each pair is visited with exactly one
+    // batch of out groups, and out groups that are not resident have no vamana instance
+    void UniNavGraph::visit_group_pairs(const std::vector<std::vector<IdxType>>& out_group_ids, IdxType chunk_size,
+                                        const std::function<void(IdxType, IdxType, IdxType)>& visit) {
+        uint64_t budget = _out_of_core ? _build_options.memory_budget_mb * 1024 * 1024 / 2 : 0;
+        std::vector<IdxType> group_ids;
+        for (IdxType group_id=1; group_id<=_num_groups; ++group_id)
+            if (!out_group_ids[group_id].empty())
+                group_ids.push_back(group_id);
+        std::vector<std::vector<IdxType>> in_batches, out_batches;
+        get_group_batches(group_ids, budget, in_batches);
+
+        for (const auto& in_batch : in_batches) {
+            std::vector<bool> in_current_batch(_num_groups + 1, false);
+            std::vector<IdxType> needed_group_ids;
+            for (auto group_id : in_batch) {
+                in_current_batch[group_id] = true;
+                needed_group_ids.insert(needed_group_ids.end(), out_group_ids[group_id].begin(), out_group_ids[group_id].end());
+            }
+            std::sort(needed_group_ids.begin(), needed_group_ids.end());
+            needed_group_ids.erase(std::unique(needed_group_ids.begin(), needed_group_ids.end()), needed_group_ids.end());
+            get_group_batches(needed_group_ids, budget, out_batches);
+            if (_out_of_core)
+                for (auto group_id : in_batch)
+                    load_group(group_id, false);
+
+            // chunks of the vectors of each group
+            std::vector<std::pair<IdxType, IdxType>> tasks;
+            for (auto group_id : in_batch) {
+                const auto& range = _group_id_to_range[group_id];
+                for (IdxType start=range.first; start<range.second; start+=std::min(chunk_size, range.second-start))
+                    tasks.emplace_back(group_id, start);
+            }
+
+            for (const auto& out_batch : out_batches) {
+                if (_out_of_core)
+                    for (auto group_id : out_batch)
+                        load_group(group_id, true);
+
+                #pragma omp parallel for schedule(dynamic, 1)
+                for (size_t task_id=0; task_id<tasks.size(); ++task_id) {
+                    if (task_id % 1000 == 0)
+                        std::cout << "\r" << (100.0 * task_id) / tasks.size() << "%" << std::flush;
+                    auto [group_id, start] = tasks[task_id];
+                    visit(group_id, start, start + std::min(chunk_size, _group_id_to_range[group_id].second-start));
+                }
+
+                if (_out_of_core)
+                    for (auto group_id : out_batch)
+                        release_group(group_id, in_current_batch[group_id]);
+            }
+            if (_out_of_core)
+                for (auto group_id : in_batch)
+                    release_group(group_id, false);
+        }
+    }
+
+
+
     void UniNavGraph::build_complete_graph(std::shared_ptr<Graph> graph, IdxType num_points) {
         for (auto i=0; i<num_points; ++i)
             for (auto j=0; j<num_points; ++j)
@@ -243,6 +744,7 @@ namespace ANNS {
         for (auto group_id=1; group_id<=_num_groups; ++group_id)
             for (auto each : _label_nav_graph->out_neighbors[group_id])
                 _label_nav_graph->in_neighbors[each].emplace_back(group_id);
+        compute_root_group_ids();
 
         _build_LNG_time = std::chrono::duration_cast<std::chrono::milliseconds>(
                           std::chrono::high_resolution_clock::now() - start_time).count();
@@ -251,6 +753,106 @@ namespace ANNS {
 
 
 
+    // groups without any subset group, which are the entry groups when there is no filter
+    void UniNavGraph::compute_root_group_ids() {
+        _root_group_ids.clear();
+        for (IdxType group_id=1; group_id<=_num_groups; ++group_id)
+            if (_label_nav_graph->in_neighbors[group_id].empty())
+                _root_group_ids.emplace_back(group_id);
+    }
+
+
+
+    // entry groups of a query, looked up in the label set cache first
+    void UniNavGraph::get_entry_group_ids(IdxType query_id, std::vector<IdxType>& entry_group_ids) {
+        const auto& query_label_set = get_query_label_set(query_id);
+
+        // in batch mode, the entry groups have been resolved for the bucket of the query
+        if (!_query_bucket_ids.empty()) {
+            entry_group_ids = _bucket_entry_group_ids[_query_bucket_ids[query_id]];
+            return;
+        }
+        if (!_label_set_cache.enabled()) {
+            resolve_entry_group_ids(query_label_set, entry_group_ids);
+            return;
+        }
+        if (_label_set_cache.get(query_label_set, entry_group_ids))
+            return;
+        resolve_entry_group_ids(query_label_set, entry_group_ids);
+        _label_set_cache.put(query_label_set, entry_group_ids);
+    }
+
+
+
+    void UniNavGraph::get_entry_groups(const std::vector<LabelType>& label_set, const std::string& scenario,
+                                       std::vector<IdxType>& entry_group_ids) {
+        _scenario = scenario;
+        resolve_entry_group_ids(label_set, entry_group_ids);
+    }
+
+
+
+    // resolve the entry groups of a query with the label navigating graph, instead of comparing candidates pairwise
+    void UniNavGraph::resolve_entry_group_ids(const std::vector<LabelType>& query_label_set, 
+                                              std::vector<IdxType>& entry_group_ids) {
+        entry_group_ids.clear();
+        bool need_containment = _scenario != "overlap";
+
+        // without the label navigating graph (equality index), fall back to pairwise comparisons
+        if (_label_nav_graph == nullptr) {
+            if (_scenario == "nofilter")
+                get_min_super_sets({}, entry_group_ids, true, true);
+            else
+                get_min_super_sets(query_label_set, entry_group_ids, false, need_containment);
+            return;
+        }
+
+        // all root groups for nofilter, and an existing label set is its own only minimum super set
+        if (_scenario == "nofilter") {
+            entry_group_ids = _root_group_ids;
+            return;
+        }
+        if (need_containment) {
+            auto node_id = _trie_index.find_exact_match(query_label_set);
+            if (node_id != FlatTrieIndex::NONE) {
+                entry_group_ids.emplace_back(_trie_index.get_node(node_id).group_id);
+                return;
+            }
+        }
+
+        // a candidate is minimum iff none of its in-neighbors, i.e., its largest subset groups, matches the query
+        std::vector<IdxType> candidates;
+        _trie_index.get_super_set_entrances(query_label_set, candidates, false, need_containment);
+        uint64_t query_bits[LabelBitsets::MAX_NUM_WORDS];
+        if (_group_label_bitsets.enabled())
+            _group_label_bitsets.encode(query_label_set, query_bits);
+        for (auto candidate : candidates) {
+            auto group_id = _trie_index.get_node(candidate).group_id;
+            bool is_min = true;
+            for (auto in_group_id : _label_nav_graph->in_neighbors[group_id]) {
+                bool match;
+                const auto& in_label_set = _group_id_to_label_set[in_group_id];
+                if (_group_label_bitsets.enabled())
+                    match = need_containment ? _group_label_bitsets.is_subset(query_bits, _group_label_bitsets.get(in_group_id))
+                                             : _group_label_bitsets.intersects(query_bits, _group_label_bitsets.get(in_group_id));
+                else if (need_containment)
+                    match = std::includes(in_label_set.begin(), in_label_set.end(), 
+                                          query_label_set.begin(), query_label_set.end());
+                else
+                    match = std::find_first_of(in_label_set.begin(), in_label_set.end(), 
+                                               query_label_set.begin(), query_label_set.end()) != in_label_set.end();
+                if (match) {
+                    is_min = false;
+                    break;
+                }
+            }
+            if (is_min)
+                entry_group_ids.emplace_back(group_id);
+        }
+    }
+
+
+
     void UniNavGraph::add_offset_for_uni_nav_graph() {
         omp_set_num_threads(_num_threads);
         #pragma omp parallel for schedule(dynamic, 4096)
@@ -265,11 +867,39 @@ namespace ANNS {
         std::cout << "Building cross-group edges ..." << std::endl;
         auto start_time = std::chrono::high_resolution_clock::now();
         
-        // allocate memory for storaging cross-group neighbors
-        std::vector<SearchQueue> cross_group_neighbors;
-        cross_group_neighbors.resize(_num_points);
-        for (auto point_id=0; point_id<_num_points; ++point_id)
-            cross_group_neighbors[point_id].reserve(_num_cross_edges);
+        // cross-group neighbors of each vector in num_cross_edges fixed slots of flat arrays, kept sorted by distance
+        // and then id as in a search queue, instead of a heap-allocated queue per vector, when pruned the slots hold
+        // a larger pool of candidates from all out-neighbor groups
+        IdxType num_slots = _num_cross_edges;
+        if (_build_options.prune_cross_edges)
+            num_slots = std::min(_Lbuild, default_paras::CROSS_EDGE_POOL_FACTOR * _num_cross_edges);
+        std::vector<IdxType> cross_neighbor_ids(static_cast<uint64_t>(_num_points) * num_slots);
+        std::vector<float> cross_neighbor_dists(static_cast<uint64_t>(_num_points) * num_slots);
+        std::vector<IdxType> num_cross_neighbors(_num_points, 0);
+        auto insert_cross_neighbor = [&](IdxType vec_id, IdxType id, float distance) {
+            auto ids = cross_neighbor_ids.data() + static_cast<uint64_t>(vec_id) * num_slots;
+            auto dists = cross_neighbor_dists.data() + static_cast<uint64_t>(vec_id) * num_slots;
+            auto& size = num_cross_neighbors[vec_id];
+            auto closer_than = [&](IdxType slot) {
+                return distance < dists[slot] || (distance == dists[slot] && id < ids[slot]);
+            };
+            if (num_slots == 0 || (size == num_slots && !closer_than(size - 1)))
+                return;
+            for (IdxType slot=0; slot<size; ++slot)
+                if (ids[slot] == id)
+                    return;
+
+            // shift farther neighbors by one slot, dropping the last one if full
+            IdxType pos = std::min(size, num_slots - 1);
+            for (; pos > 0 && closer_than(pos - 1); --pos) {
+                ids[pos] = ids[pos - 1];
+                dists[pos] = dists[pos - 1];
+            }
+            ids[pos] = id;
+            dists[pos] = distance;
+            if (size < num_slots)
+                size++;
+        };
 
         // allocate memory for search caches
         size_t max_group_size = 0;
@@ -277,87 +907,118 @@ namespace ANNS {
             max_group_size = std::max(max_group_size, _group_id_to_vec_ids[group_id].size());
         SearchCacheList search_cache_list(_num_threads, max_group_size, _Lbuild);
         omp_set_num_threads(_num_threads);
+        if (_index_name != "Vamana") {
+            std::cerr << "Error: invalid index name " << _index_name << std::endl;
+            exit(-1);
+        }
+        if (_num_cross_edges > _Lbuild) {
+            std::cerr << "Error: num_cross_edges should be less than or equal to Lbuild" << std::endl;
+            exit(-1);
+        }
 
-        // for each group
-        for (auto group_id=1; group_id<=_num_groups; ++group_id) {
-            if (_label_nav_graph->in_neighbors[group_id].size() > 0) {
-                if (group_id % 100 == 0)
-                    std::cout << "\r" << (100.0 * group_id) / _num_groups << "%" << std::flush;
-                IdxType offset = _group_id_to_range[group_id].first;
-
-                // query vamana index
-                if (_index_name == "Vamana") {
-                    auto index = _vamana_instances[group_id];
-                    if (_num_cross_edges > _Lbuild) {
-                        std::cerr << "Error: num_cross_edges should be less than or equal to Lbuild" << std::endl;
-                        exit(-1);
-                    }
-
-                    // for each in-neighbor group
-                    for (auto in_group_id : _label_nav_graph->in_neighbors[group_id]) {
-                        const auto& range = _group_id_to_range[in_group_id];
-
-                        // take each vector in the group as the query
-                        #pragma omp parallel for schedule(dynamic, 1)
-                        for (auto vec_id=range.first; vec_id<range.second; ++vec_id) {
-                            const char* query = _base_storage->get_vector(vec_id);
-                            auto search_cache = search_cache_list.get_free_cache(); 
-                            index->iterate_to_fixed_point(query, search_cache);
-
-                            // update the cross-group edges for vec_id
-                            for (auto k=0; k<search_cache->search_queue.size(); ++k)
-                                cross_group_neighbors[vec_id].insert(search_cache->search_queue[k].id + offset, 
-                                                                     search_cache->search_queue[k].distance);
-                            search_cache_list.release_cache(search_cache);
-                        }
-                    }
-                
-                // if none of the above
-                } else {
-                    std::cerr << "Error: invalid index name " << _index_name << std::endl;
-                    exit(-1);
+        // chunks of vectors of a group search all resident out-neighbor groups, so that the cross-group neighbors of
+        // each vector are only updated by one task at a time
+        visit_group_pairs(_label_nav_graph->out_neighbors, default_paras::CROSS_EDGE_CHUNK_SIZE, 
+                          [&](IdxType group_id, IdxType start, IdxType end) {
+            auto search_cache = search_cache_list.get_free_cache(); 
+            auto vecs = _group_storages[group_id];
+            auto vec_offset = _group_id_to_range[group_id].first;
+            for (auto out_group_id : _label_nav_graph->out_neighbors[group_id]) {
+                auto index = _vamana_instances[out_group_id];
+                if (index == nullptr)
+                    continue;
+                IdxType offset = _group_id_to_range[out_group_id].first;
+                for (auto vec_id=start; vec_id<end; ++vec_id) {
+                    index->iterate_to_fixed_point(vecs->get_vector(vec_id - vec_offset), search_cache);
+
+                    // update the cross-group edges for vec_id
+                    for (auto k=0; k<search_cache->search_queue.size(); ++k)
+                        insert_cross_neighbor(vec_id, search_cache->search_queue[k].id + offset, 
+                                              search_cache->search_queue[k].distance);
+                }
+            }
+            search_cache_list.release_cache(search_cache);
+        });
+
+        // optionally robust prune the pool of each vector once over all out-neighbor groups, only the survivors
+        // become cross-group edges
+        if (_build_options.prune_cross_edges) {
+            Vamana pruner(_base_storage, _distance_handler, nullptr, 0);
+            #pragma omp parallel for schedule(dynamic, 256)
+            for (IdxType vec_id=0; vec_id<_num_points; ++vec_id) {
+                auto search_cache = search_cache_list.get_free_cache();
+                auto ids = cross_neighbor_ids.data() + static_cast<uint64_t>(vec_id) * num_slots;
+                auto dists = cross_neighbor_dists.data() + static_cast<uint64_t>(vec_id) * num_slots;
+                std::vector<Candidate> pool;
+                std::vector<IdxType> pruned_list;
+                for (IdxType slot=0; slot<num_cross_neighbors[vec_id]; ++slot)
+                    pool.emplace_back(ids[slot], dists[slot]);
+                pruner.prune_candidates(pool, pruned_list, _alpha, _num_cross_edges, search_cache);
+
+                // the pool is sorted by distance after pruning, keep the survivors in that order
+                IdxType size = 0;
+                for (const auto& candidate : pool) {
+                    if (std::find(pruned_list.begin(), pruned_list.end(), candidate.id) == pruned_list.end())
+                        continue;
+                    ids[size] = candidate.id;
+                    dists[size++] = candidate.distance;
                 }
+                num_cross_neighbors[vec_id] = size;
+                search_cache_list.release_cache(search_cache);
             }
         }
 
-        // add additional edges
-        std::vector<std::vector<std::pair<IdxType, IdxType>>> additional_edges(_num_groups+1);
+        // obtain out-neighbor groups that no vector is connected to
+        std::vector<std::vector<IdxType>> unconnected_group_ids(_num_groups+1);
         #pragma omp parallel for schedule(dynamic, 256)
         for (IdxType group_id=1; group_id <= _num_groups; ++group_id) {
             const auto& cur_range = _group_id_to_range[group_id];
             std::unordered_set<IdxType> connected_groups;
-
-            // obtain connected groups
             for (IdxType i=cur_range.first; i<cur_range.second; ++i)
-                for (IdxType j=0; j<cross_group_neighbors[i].size(); ++j)
-                    connected_groups.insert(_new_vec_id_to_group_id[cross_group_neighbors[i][j].id]);
-
-            // add additional cross-group edges for unconnected groups
+                for (IdxType j=0; j<num_cross_neighbors[i]; ++j)
+                    connected_groups.insert(_new_vec_id_to_group_id[cross_neighbor_ids[static_cast<uint64_t>(i) * num_slots + j]]);
             for (IdxType out_group_id : _label_nav_graph->out_neighbors[group_id])
-                if (connected_groups.find(out_group_id) == connected_groups.end()) {
-                    IdxType cnt = 0;
-                    for (auto vec_id=cur_range.first; vec_id<cur_range.second && cnt < _num_cross_edges; ++vec_id) {
-                        auto search_cache = search_cache_list.get_free_cache(); 
-                        _vamana_instances[out_group_id]->iterate_to_fixed_point(_base_storage->get_vector(vec_id), search_cache);
-
-                        for (auto k=0; k<search_cache->search_queue.size() && k<_num_cross_edges / 2; ++k) {
-                            additional_edges[group_id].emplace_back(vec_id,
-                                                                    search_cache->search_queue[k].id + _group_id_to_range[out_group_id].first);
-                            cnt += 1;
-                        }
-                        search_cache_list.release_cache(search_cache);
+                if (connected_groups.find(out_group_id) == connected_groups.end())
+                    unconnected_group_ids[group_id].push_back(out_group_id);
+        }
+
+        // add additional cross-group edges for unconnected groups, each task covers a whole group
+        std::vector<std::vector<std::pair<IdxType, IdxType>>> additional_edges(_num_groups+1);
+        visit_group_pairs(unconnected_group_ids, std::numeric_limits<IdxType>::max(), 
+                          [&](IdxType group_id, IdxType start, IdxType end) {
+            auto vecs = _group_storages[group_id];
+            auto vec_offset = _group_id_to_range[group_id].first;
+            for (IdxType out_group_id : unconnected_group_ids[group_id]) {
+                if (_vamana_instances[out_group_id] == nullptr)
+                    continue;
+                IdxType cnt = 0;
+                for (auto vec_id=start; vec_id<end && cnt < _num_cross_edges; ++vec_id) {
+                    auto search_cache = search_cache_list.get_free_cache(); 
+                    _vamana_instances[out_group_id]->iterate_to_fixed_point(vecs->get_vector(vec_id - vec_offset), search_cache);
+
+                    for (auto k=0; k<search_cache->search_queue.size() && k<_num_cross_edges / 2; ++k) {
+                        additional_edges[group_id].emplace_back(vec_id,
+                                                                search_cache->search_queue[k].id + _group_id_to_range[out_group_id].first);
+                        cnt += 1;
                     }
+                    search_cache_list.release_cache(search_cache);
                 }
-        }
+            }
+        });
+
+        // the group graphs are complete, bring back the spilled ones
+        if (_out_of_core)
+            load_spilled_graph();
 
         // add offset for uni-nav graph
         add_offset_for_uni_nav_graph();
 
         // merge cross-group edges
         #pragma omp parallel for schedule(dynamic, 4096)
-        for (auto point_id=0; point_id<_num_points; ++point_id)
-            for (auto k=0; k<cross_group_neighbors[point_id].size(); ++k)
-                _graph->neighbors[point_id].emplace_back(cross_group_neighbors[point_id][k].id);
+        for (auto point_id=0; point_id<_num_points; ++point_id) {
+            auto ids = cross_neighbor_ids.data() + static_cast<uint64_t>(point_id) * num_slots;
+            _graph->neighbors[point_id].insert(_graph->neighbors[point_id].end(), ids, ids + num_cross_neighbors[point_id]);
+        }
 
         // merge additional cross-group edges
         #pragma omp parallel for schedule(dynamic, 256)
@@ -375,137 +1036,637 @@ namespace ANNS {
 
     void UniNavGraph::search(std::shared_ptr<IStorage> query_storage, std::shared_ptr<DistanceHandler> distance_handler, 
                              uint32_t num_threads, IdxType Lsearch, IdxType num_entry_points, std::string scenario,
-                             IdxType K, std::pair<IdxType, float>* results, std::vector<float>& num_cmps) {
+                             IdxType K, std::pair<IdxType, float>* results, std::vector<float>& num_cmps,
+                             const SearchOptions& options, std::vector<QueryStats>* query_stats) {
         auto num_queries = query_storage->get_num_points();
         _query_storage = query_storage;
         _distance_handler = distance_handler;
         _scenario = scenario;
+        _K = K;
+        _entry_point_set_size = options.entry_point_set_size;
+        if (_group_entry_point_sets.empty())
+            compute_group_entry_point_sets();
+        if (!_label_map.empty())
+            remap_query_labels();
+
+        // the label set cache persists across calls, and is reset when its capacity or the scenario changes
+        if (options.label_cache_capacity != _label_cache_capacity || scenario != _label_cache_scenario) {
+            _label_set_cache.init(options.label_cache_capacity);
+            _label_cache_capacity = options.label_cache_capacity;
+            _label_cache_scenario = scenario;
+        }
+        if (query_stats != nullptr)
+            query_stats->assign(num_queries, QueryStats());
+
+        // batch mode: bucket the queries by label set, resolve the entry groups once per bucket
+        _query_order.clear();
+        _query_bucket_ids.clear();
+        _bucket_entry_group_ids.clear();
+        if (options.group_by_label_set)
+            bucket_queries_by_label_set(num_threads);
 
         // preparation
         if (K > Lsearch) {
             std::cerr << "Error: K should be less than or equal to Lsearch" << std::endl;
             exit(-1);
         }
+        omp_set_num_threads(num_threads);
+
+        // interleave several queries per thread to overlap their memory stalls
+        if (options.num_interleaved_queries > 1) {
+            search_interleaved(num_threads, Lsearch, num_entry_points, K, results, num_cmps, options, query_stats);
+            return;
+        }
         SearchCacheList search_cache_list(num_threads, _num_points, Lsearch);
 
+        // the beam threads are nested inside the per-query threads, capped so that both levels together fit the
+        // cores, the previous nesting level is restored afterwards
+        int max_active_levels = omp_get_max_active_levels();
+        _num_beam_threads = 1;
+        if (options.beam_width > 1 && options.num_beam_threads > 1)
+            _num_beam_threads = std::min<uint32_t>(options.num_beam_threads, 
+                                                   std::max<uint32_t>(1, omp_get_num_procs() / num_threads));
+        if (_num_beam_threads > 1)
+            omp_set_max_active_levels(std::max(max_active_levels, 2));
+
         // run queries
-        omp_set_num_threads(num_threads);
         #pragma omp parallel for schedule(dynamic, 1)
-        for (auto id = 0; id < num_queries; ++id) {
+        for (IdxType pos = 0; pos < num_queries; ++pos) {
+            IdxType id = _query_order.empty() ? pos : _query_order[pos];
             auto search_cache = search_cache_list.get_free_cache(); 
             const char* query = _query_storage->get_vector(id);
+            QueryStats* stats = query_stats != nullptr ? &(*query_stats)[id] : nullptr;
             SearchQueue cur_result;
+            search_cache->start_budget(options.time_budget_ms, options.max_num_cmps);
+
+            // for very selective filters, scan the matching groups instead of graph search
+            std::vector<IdxType> matching_group_ids;
+            if (options.scan_threshold > 0 && 
+                get_matching_groups(get_query_label_set(id), options.scan_threshold, matching_group_ids)) {
+                cur_result.reserve(K);
+                num_cmps[id] = scan_groups(query, matching_group_ids, cur_result);
 
-            // for overlap or nofilter scenario
-            if (scenario == "overlap" || scenario == "nofilter") {
+            // for overlap or nofilter scenario, search from each entry group separately
+            } else if (scenario == "overlap" || scenario == "nofilter") {
                 num_cmps[id] = 0;
                 search_cache->visited_set.clear();
                 cur_result.reserve(K);
 
                 // obtain entry group
                 std::vector<IdxType> entry_group_ids;
-                if (scenario == "overlap")
-                    get_min_super_sets(_query_storage->get_label_set(id), entry_group_ids, false, false);
-                else
-                    get_min_super_sets({}, entry_group_ids, true, true);
+                get_entry_group_ids(id, entry_group_ids);
+                num_cmps[id] += rank_entry_groups(query, entry_group_ids, options);
 
-                // for each entry group
+                // for each entry group, until the budget runs out
                 for (const auto& group_id : entry_group_ids) {
-                    std::vector<IdxType> entry_points;
-                    get_entry_points_given_group_id(num_entry_points, search_cache->visited_set, group_id, entry_points);
+                    if (search_cache->out_of_budget)
+                        break;
+                    search_cache->search_queue.clear();
+                    num_cmps[id] += seed_entry_points_given_group_id(query, num_entry_points, group_id, search_cache);
 
                     // graph search and dump to current result
-                    num_cmps[id] += iterate_to_fixed_point(query, search_cache, id, entry_points, true, false); 
+                    num_cmps[id] += iterate_to_fixed_point(query, search_cache, id, {}, options, false, false, stats); 
                     for (auto k=0; k<search_cache->search_queue.size() && k<K; ++k)
                         cur_result.insert(search_cache->search_queue[k].id, search_cache->search_queue[k].distance);
                 }
 
-            // for the other scenarios: containment, equality
+            // otherwise, a single traversal for containment or equality scenario
             } else {
             
-                // obtain entry points
-                auto entry_points = get_entry_points(_query_storage->get_label_set(id), num_entry_points, search_cache->visited_set);
-                if (entry_points.empty()) {
-                    num_cmps[id] = 0;
-                    for (auto k=0; k<K; ++k)
-                        results[id*K+k].first = -1;
-                    continue;
-                }
+                // obtain entry points, no entry point means no vector matches the query
+                num_cmps[id] = seed_entry_points(id, num_entry_points, options, search_cache);
 
                 // graph search
-                num_cmps[id] = iterate_to_fixed_point(query, search_cache, id, entry_points);  
+                num_cmps[id] += iterate_to_fixed_point(query, search_cache, id, {}, options, false, false, stats);  
                 cur_result = search_cache->search_queue;
             }
 
-            // write results
-            for (auto k=0; k<K; ++k) {
-                if (k < cur_result.size()) {
-                    results[id*K+k].first = _new_to_old_vec_ids[cur_result[k].id];
-                    results[id*K+k].second = cur_result[k].distance;
-                } else
-                    results[id*K+k].first = -1;
+            // write results and clean
+            write_results(id, K, cur_result, results);
+            if (stats != nullptr)
+                stats->partial = search_cache->out_of_budget;
+            search_cache_list.release_cache(search_cache);
+        }
+        omp_set_max_active_levels(max_active_levels);
+    }
+
+
+
+    void UniNavGraph::write_results(IdxType query_id, IdxType K, const SearchQueue& cur_result,
+                                    std::pair<IdxType, float>* results) {
+        for (auto k=0; k<K; ++k) {
+            if (k < cur_result.size()) {
+                results[query_id*K+k].first = _new_to_old_vec_ids[cur_result[k].id];
+                results[query_id*K+k].second = cur_result[k].distance;
+            } else
+                results[query_id*K+k].first = -1;
+        }
+    }
+
+
+
+    // queries sharing a label set form a bucket, buckets with the same first entry group are scheduled next to
+    // each other so that threads concurrently work on the same groups
+    void UniNavGraph::bucket_queries_by_label_set(uint32_t num_threads) {
+        IdxType num_queries = _query_storage->get_num_points();
+
+        // bucket queries with a trie over the query label sets
+        FlatTrieIndex query_trie_index;
+        IdxType new_bucket_id = 1;
+        std::vector<IdxType> bucket_first_query;
+        _query_bucket_ids.resize(num_queries);
+        for (IdxType query_id=0; query_id<num_queries; ++query_id) {
+            auto bucket_id = query_trie_index.insert(get_query_label_set(query_id), new_bucket_id) - 1;
+            if (bucket_id == bucket_first_query.size())
+                bucket_first_query.emplace_back(query_id);
+            _query_bucket_ids[query_id] = bucket_id;
+        }
+        IdxType num_buckets = bucket_first_query.size();
+
+        // resolve the entry groups of each bucket
+        _bucket_entry_group_ids.resize(num_buckets);
+        if (_scenario != "equality") {
+            omp_set_num_threads(num_threads);
+            #pragma omp parallel for schedule(dynamic, 16)
+            for (IdxType bucket_id=0; bucket_id<num_buckets; ++bucket_id)
+                resolve_entry_group_ids(get_query_label_set(bucket_first_query[bucket_id]), 
+                                        _bucket_entry_group_ids[bucket_id]);
+        }
+
+        // order buckets by their first entry group, then queries by bucket
+        std::vector<IdxType> bucket_order(num_buckets), bucket_offsets(num_buckets+1, 0);
+        for (IdxType bucket_id=0; bucket_id<num_buckets; ++bucket_id)
+            bucket_order[bucket_id] = bucket_id;
+        auto first_group = [&](IdxType bucket_id) {
+            return _bucket_entry_group_ids[bucket_id].empty() ? 0 : _bucket_entry_group_ids[bucket_id][0];
+        };
+        std::stable_sort(bucket_order.begin(), bucket_order.end(), [&](IdxType a, IdxType b) {
+            return first_group(a) < first_group(b);
+        });
+        std::vector<IdxType> bucket_rank(num_buckets);
+        for (IdxType i=0; i<num_buckets; ++i)
+            bucket_rank[bucket_order[i]] = i;
+        for (IdxType query_id=0; query_id<num_queries; ++query_id)
+            bucket_offsets[bucket_rank[_query_bucket_ids[query_id]]+1]++;
+        for (IdxType i=0; i<num_buckets; ++i)
+            bucket_offsets[i+1] += bucket_offsets[i];
+        _query_order.resize(num_queries);
+        for (IdxType query_id=0; query_id<num_queries; ++query_id)
+            _query_order[bucket_offsets[bucket_rank[_query_bucket_ids[query_id]]]++] = query_id;
+    }
+
+
+
+    // a query in flight during interleaved search, advanced one stage at a time
+    struct InterleavedQuery {
+        enum Stage { EXPAND, FILTER, SCORE };
+        IdxType id;
+        bool active = false;
+        Stage stage = EXPAND;
+        std::shared_ptr<SearchCache> search_cache;
+        std::vector<IdxType> neighbors;         // neighbors of the node being expanded
+        std::vector<IdxType> pending;           // unvisited neighbors whose vectors are being fetched
+        IdxType num_hops;                       // expansions so far, for reading the clock every few of them
+        IdxType num_stable;                     // early termination state of the current traversal
+        float kth_distance;
+        IdxType num_uncharged_cmps;             // distance computations of the last expansion, charged before the next
+        bool multi_group = false;               // overlap/nofilter: the entry groups are searched one by one
+        std::vector<IdxType> entry_group_ids;   // overlap/nofilter: entry groups still to be searched
+        SearchQueue cur_result;                 // overlap/nofilter: results merged across entry groups
+    };
+
+
+
+    void UniNavGraph::search_interleaved(uint32_t num_threads, IdxType Lsearch, IdxType num_entry_points, IdxType K,
+                                         std::pair<IdxType, float>* results, std::vector<float>& num_cmps,
+                                         const SearchOptions& options, std::vector<QueryStats>* query_stats) {
+        IdxType num_queries = _query_storage->get_num_points();
+        IdxType num_slots = options.num_interleaved_queries;
+        auto dim = _base_storage->get_dim();
+        SearchCacheList search_cache_list(num_threads * num_slots, _num_points, Lsearch);
+        std::atomic<IdxType> next_query_id(0);
+
+        #pragma omp parallel
+        {
+            std::vector<InterleavedQuery> slots(num_slots);
+            for (auto& slot : slots)
+                slot.search_cache = search_cache_list.get_free_cache();
+
+            // each step advances every query in flight by one stage, so that the prefetches issued
+            // by a query are served while the other queries are being processed
+            bool exhausted = false;
+            IdxType num_active = 0;
+            while (!exhausted || num_active > 0) {
+                for (auto& slot : slots) {
+                    auto& search_queue = slot.search_cache->search_queue;
+                    auto& visited_set = slot.search_cache->visited_set;
+
+                    // refill an idle slot with the next query that needs a graph traversal
+                    if (!slot.active) {
+                        while (!exhausted && !slot.active) {
+                            IdxType pos = next_query_id++;
+                            if (pos >= num_queries) {
+                                exhausted = true;
+                                break;
+                            }
+                            slot.id = _query_order.empty() ? pos : _query_order[pos];
+                            if (start_query(slot.id, num_entry_points, K, options, slot.search_cache, 
+                                                 slot.multi_group, slot.entry_group_ids, slot.cur_result, results, 
+                                                 num_cmps)) {
+                                slot.active = true;
+                                slot.stage = InterleavedQuery::EXPAND;
+                                slot.num_hops = 0;
+                                slot.num_stable = 0;
+                                slot.kth_distance = std::numeric_limits<float>::max();
+                                slot.num_uncharged_cmps = 0;
+                                num_active++;
+                            }
+                        }
+                        continue;
+                    }
+
+                    // pop the closest unexpanded node and request the visited marks of its neighbors
+                    if (slot.stage == InterleavedQuery::EXPAND) {
+                        // the same stop conditions in the same order as iterate_to_fixed_point
+                        bool stop = !search_queue.has_unexpanded_node() || 
+                                    terminate_early(search_queue, options, slot.num_stable, slot.kth_distance) ||
+                                    slot.search_cache->exceed_budget(slot.num_uncharged_cmps, 
+                                        slot.num_hops % std::max<IdxType>(options.budget_check_interval, 1) == 0);
+                        bool out_of_budget = slot.search_cache->out_of_budget;
+                        slot.num_uncharged_cmps = 0;
+                        if (stop) {
+                            if (query_stats != nullptr)
+                                (*query_stats)[slot.id].num_hops_saved += search_queue.num_unexpanded();
+
+                            // move on to the next entry group when searching them one by one
+                            if (slot.multi_group) {
+                                for (auto k=0; k<search_queue.size() && k<K; ++k)
+                                    slot.cur_result.insert(search_queue[k].id, search_queue[k].distance);
+                                if (!slot.entry_group_ids.empty() && !out_of_budget) {
+                                    search_queue.clear();
+                                    num_cmps[slot.id] += seed_entry_points_given_group_id(
+                                        _query_storage->get_vector(slot.id), num_entry_points, 
+                                        slot.entry_group_ids.back(), slot.search_cache);
+                                    slot.entry_group_ids.pop_back();
+                                    slot.num_hops = 0;
+                                    slot.num_stable = 0;
+                                    slot.kth_distance = std::numeric_limits<float>::max();
+                                    continue;
+                                }
+                            }
+                            write_results(slot.id, K, slot.multi_group ? slot.cur_result : search_queue, 
+                                          results);
+                            if (query_stats != nullptr)
+                                (*query_stats)[slot.id].partial = out_of_budget;
+                            slot.active = false;
+                            num_active--;
+                            continue;
+                        }
+                        const Candidate& cur = search_queue.get_closest_unexpanded();
+                        {
+                            std::lock_guard<std::mutex> lock(_graph->neighbor_locks[cur.id]);
+                            slot.neighbors = _graph->neighbors[cur.id];
+                        }
+                        slot.num_hops++;
+                        if (query_stats != nullptr)
+                            (*query_stats)[slot.id].num_hops++;
+                        for (const auto& neighbor : slot.neighbors)
+                            visited_set.prefetch(neighbor);
+                        slot.stage = InterleavedQuery::FILTER;
+
+                    // skip visited neighbors and request the vectors of the others
+                    } else if (slot.stage == InterleavedQuery::FILTER) {
+                        slot.pending.clear();
+                        for (const auto& neighbor : slot.neighbors) {
+                            if (visited_set.check(neighbor))
+                                continue;
+                            visited_set.set(neighbor);
+                            _base_storage->prefetch_vec_by_id(neighbor);
+                            slot.pending.push_back(neighbor);
+                        }
+                        slot.stage = slot.pending.empty() ? InterleavedQuery::EXPAND : InterleavedQuery::SCORE;
+
+                    // compute distances and request the neighbor list of the next node to expand
+                    } else {
+                        for (const auto& neighbor : slot.pending)
+                            search_queue.insert(neighbor, _distance_handler->compute(
+                                _query_storage->get_vector(slot.id), _base_storage->get_vector(neighbor), dim));
+                        num_cmps[slot.id] += slot.pending.size();
+                        slot.num_uncharged_cmps = slot.pending.size();
+                        if (search_queue.has_unexpanded_node())
+                            _graph->prefetch_neighbors(search_queue.peek_closest_unexpanded().id);
+                        slot.stage = InterleavedQuery::EXPAND;
+                    }
+                }
+            }
+
+            for (auto& slot : slots)
+                search_cache_list.release_cache(slot.search_cache);
+        }
+    }
+
+
+
+    bool UniNavGraph::start_query(IdxType query_id, IdxType num_entry_points, IdxType K, const SearchOptions& options,
+                                  std::shared_ptr<SearchCache> search_cache, bool& multi_group,
+                                  std::vector<IdxType>& entry_group_ids, SearchQueue& cur_result,
+                                  std::pair<IdxType, float>* results, std::vector<float>& num_cmps) {
+        const char* query = _query_storage->get_vector(query_id);
+        const auto& query_label_set = get_query_label_set(query_id);
+        multi_group = false;
+
+        // very selective filters are answered by scanning right away
+        std::vector<IdxType> matching_group_ids;
+        if (options.scan_threshold > 0 &&
+            get_matching_groups(query_label_set, options.scan_threshold, matching_group_ids)) {
+            SearchQueue cur_result;
+            cur_result.reserve(K);
+            num_cmps[query_id] = scan_groups(query, matching_group_ids, cur_result);
+            write_results(query_id, K, cur_result, results);
+            return false;
+        }
+
+        // for overlap or nofilter scenario, the entry groups are searched one by one and their results merged
+        cur_result = SearchQueue();
+        if (_scenario == "overlap" || _scenario == "nofilter") {
+            search_cache->search_queue.clear();
+            search_cache->visited_set.clear();
+            entry_group_ids.clear();
+            get_entry_group_ids(query_id, entry_group_ids);
+            num_cmps[query_id] = rank_entry_groups(query, entry_group_ids, options);
+            if (entry_group_ids.empty()) {
+                write_results(query_id, K, cur_result, results);
+                return false;
             }
+            std::reverse(entry_group_ids.begin(), entry_group_ids.end());
+            search_cache->start_budget(options.time_budget_ms, options.max_num_cmps);
+            cur_result.reserve(K);
+            multi_group = true;
+            num_cmps[query_id] += seed_entry_points_given_group_id(query, num_entry_points, entry_group_ids.back(),
+                                                                   search_cache);
+            entry_group_ids.pop_back();
+            return true;
+        }
 
-            // clean
-            search_cache_list.release_cache(search_cache);
+        // no entry point means no vector matches the query
+        search_cache->start_budget(options.time_budget_ms, options.max_num_cmps);
+        num_cmps[query_id] = seed_entry_points(query_id, num_entry_points, options, search_cache);
+        if (search_cache->search_queue.size() == 0) {
+            write_results(query_id, K, search_cache->search_queue, results);
+            return false;
         }
+        return true;
     }
 
 
 
-    std::vector<IdxType> UniNavGraph::get_entry_points(const std::vector<LabelType>& query_label_set, 
-                                                       IdxType num_entry_points, VisitedSet& visited_set) {
-        std::vector<IdxType> entry_points;
-        entry_points.reserve(num_entry_points);
-        visited_set.clear();
+    // obtain all groups satisfying the filter, return false once they contain more than max_num_points vectors
+    bool UniNavGraph::get_matching_groups(const std::vector<LabelType>& query_label_set, IdxType max_num_points,
+                                          std::vector<IdxType>& matching_group_ids) {
+        matching_group_ids.clear();
+
+        // nofilter scenario: all groups
+        if (_scenario == "nofilter") {
+            if (_num_points > max_num_points)
+                return false;
+            for (IdxType group_id=1; group_id<=_num_groups; ++group_id)
+                matching_group_ids.emplace_back(group_id);
+            return true;
+        }
+
+        // equality scenario: the group with the same label set
+        if (_scenario == "equality") {
+            auto node_id = _trie_index.find_exact_match(query_label_set);
+            if (node_id == FlatTrieIndex::NONE)
+                return true;
+            const auto& node = _trie_index.get_node(node_id);
+            matching_group_ids.emplace_back(node.group_id);
+            return node.group_size <= max_num_points;
+        }
+
+        // containment or overlap scenario: all terminal nodes under the super set entrances
+        std::vector<IdxType> super_set_entrances;
+        _trie_index.get_super_set_entrances(query_label_set, super_set_entrances, false, _scenario != "overlap");
+        std::queue<IdxType> q;
+        for (const auto& node_id : super_set_entrances)
+            q.push(node_id);
+        IdxType num_points = 0;
+        while (!q.empty()) {
+            auto node_id = q.front();
+            const auto& cur = _trie_index.get_node(node_id);
+            q.pop();
+            if (cur.group_id > 0) {
+                matching_group_ids.emplace_back(cur.group_id);
+                num_points += cur.group_size;
+                if (num_points > max_num_points)
+                    return false;
+            }
+            for (IdxType i=0; i<cur.num_children; ++i)
+                q.push(_trie_index.get_children(node_id)[i]);
+        }
+        return true;
+    }
+
+
+
+    // exhaustively compute the distances to the vectors in the given groups, return the number of distance computations
+    IdxType UniNavGraph::scan_groups(const char* query, const std::vector<IdxType>& group_ids, SearchQueue& result) {
+        auto dim = _base_storage->get_dim();
+        IdxType num_cmps = 0;
+        for (const auto& group_id : group_ids) {
+            const auto& range = _group_id_to_range[group_id];
+            for (IdxType vec_id=range.first; vec_id<range.second; ++vec_id) {
+                if (vec_id+1 < range.second)
+                    _base_storage->prefetch_vec_by_id(vec_id+1);
+                result.insert(vec_id, _distance_handler->compute(query, _base_storage->get_vector(vec_id), dim));
+            }
+            num_cmps += range.second - range.first;
+        }
+        return num_cmps;
+    }
+
+
+
+    // seed the search queue for equality and containment queries, return the number of distance computations
+    IdxType UniNavGraph::seed_entry_points(IdxType query_id, IdxType num_entry_points, const SearchOptions& options,
+                                           std::shared_ptr<SearchCache> search_cache) {
+        const char* query = _query_storage->get_vector(query_id);
+        const auto& query_label_set = get_query_label_set(query_id);
+        search_cache->search_queue.clear();
+        search_cache->visited_set.clear();
+        IdxType num_cmps = 0;
         
         // obtain entry points for label-equality scenario
         if (_scenario == "equality") {
-            auto node = _trie_index.find_exact_match(query_label_set);
-            if (node == nullptr)
-                return entry_points;
-            get_entry_points_given_group_id(num_entry_points, visited_set, node->group_id, entry_points);
+            auto node_id = _trie_index.find_exact_match(query_label_set);
+            if (node_id == FlatTrieIndex::NONE)
+                return num_cmps;
+            num_cmps += seed_entry_points_given_group_id(query, num_entry_points, _trie_index.get_node(node_id).group_id,
+                                                         search_cache);
             
         // obtain entry points for label-containment scenario
         } else if (_scenario == "containment") {
             std::vector<IdxType> min_super_set_ids;
-            get_min_super_sets(query_label_set, min_super_set_ids);
+            get_entry_group_ids(query_id, min_super_set_ids);
+            num_cmps += rank_entry_groups(query, min_super_set_ids, options);
             for (auto group_id : min_super_set_ids)
-                get_entry_points_given_group_id(num_entry_points, visited_set, group_id, entry_points);
+                num_cmps += seed_entry_points_given_group_id(query, num_entry_points, group_id, search_cache);
 
         } else {
             std::cerr << "Error: invalid scenario " << _scenario << std::endl;
             exit(-1);
         }
 
-        return entry_points;
+        return num_cmps;
     }
 
 
 
-    void UniNavGraph::get_entry_points_given_group_id(IdxType num_entry_points, VisitedSet& visited_set, 
-                                                      IdxType group_id, std::vector<IdxType>& entry_points) {
-        const auto& group_range = _group_id_to_range[group_id];
+    // seed the search queue with the entry points of a group closest to the query, return the number of distance computations
+    IdxType UniNavGraph::seed_entry_points_given_group_id(const char* query, IdxType num_entry_points, IdxType group_id,
+                                                          std::shared_ptr<SearchCache> search_cache) {
+        auto dim = _base_storage->get_dim();
+        auto& search_queue = search_cache->search_queue;
+        auto& visited_set = search_cache->visited_set;
+
+        // compute distances for the unvisited ones among a prefix of the precomputed entry points
+        const auto& entry_point_set = _group_entry_point_sets[group_id];
+        IdxType num_scored = std::max(_entry_point_set_size, num_entry_points);
+        IdxType set_size = std::min<IdxType>(num_scored, entry_point_set.size());
+        std::vector<Candidate> candidates;
+        candidates.reserve(num_scored);
+        for (IdxType i=0; i<set_size; ++i) {
+            auto entry_point = entry_point_set[i];
+            if (visited_set.check(entry_point) == false)
+                candidates.emplace_back(entry_point, _distance_handler->compute(query, _base_storage->get_vector(entry_point), dim));
+        }
 
-        // not enough entry points, use all of them
-        if (group_range.second - group_range.first <= num_entry_points) {
-            for (auto i=0; i<group_range.second - group_range.first; ++i)
-                entry_points.emplace_back(i + group_range.first);
-            return;
+        // more entry points than precomputed, sample the others evenly over the group
+        const auto& range = _group_id_to_range[group_id];
+        IdxType num_points = range.second - range.first;
+        if (num_scored > set_size && num_points > set_size) {
+            IdxType num_samples = std::min(num_scored, num_points) - set_size;
+            IdxType stride = std::max<IdxType>(1, num_points / num_samples);
+            for (auto vec_id=range.first; vec_id<range.second && num_samples>0; vec_id+=stride) {
+                if (visited_set.check(vec_id) ||
+                    std::find(entry_point_set.begin(), entry_point_set.end(), vec_id) != entry_point_set.end())
+                    continue;
+                candidates.emplace_back(vec_id, _distance_handler->compute(query, _base_storage->get_vector(vec_id), dim));
+                num_samples -= 1;
+            }
         }
 
-        // add the entry point of the group
+        // use the closest ones
+        if (candidates.size() > num_entry_points)
+            std::nth_element(candidates.begin(), candidates.begin() + num_entry_points, candidates.end());
+        for (IdxType i=0; i<candidates.size() && i<num_entry_points; ++i) {
+            visited_set.set(candidates[i].id);
+            search_queue.insert(candidates[i].id, candidates[i].distance);
+        }
+        return candidates.size();
+    }
+
+
+
+    // keep the most promising entry groups in ascending order of their scores, return the number of distance computations
+    IdxType UniNavGraph::rank_entry_groups(const char* query, std::vector<IdxType>& entry_group_ids, 
+                                           const SearchOptions& options) {
+        if (options.max_entry_groups == 0 || entry_group_ids.size() <= options.max_entry_groups)
+            return 0;
+        auto dim = _base_storage->get_dim();
+
+        // score by the distance to the group centroid
+        std::vector<std::pair<float, IdxType>> scored_groups;
+        scored_groups.reserve(entry_group_ids.size());
+        for (auto group_id : entry_group_ids)
+            scored_groups.emplace_back(_distance_handler->compute(query, _group_centroids->get_vector(group_id), dim), 
+                                       group_id);
+
+        // discounted for larger groups, the distances are shifted to be non-negative first, since inner product
+        // distances may be negative and dividing them would rank larger groups lower
+        if (options.group_size_weight > 0) {
+            float min_distance = std::min_element(scored_groups.begin(), scored_groups.end())->first;
+            for (auto& [score, group_id] : scored_groups) {
+                const auto& range = _group_id_to_range[group_id];
+                score = (score - min_distance) / std::pow(static_cast<float>(range.second - range.first), 
+                                                          options.group_size_weight);
+            }
+        }
+
+        // keep the top ones
+        std::partial_sort(scored_groups.begin(), scored_groups.begin() + options.max_entry_groups, scored_groups.end());
+        entry_group_ids.resize(options.max_entry_groups);
+        for (IdxType i=0; i<options.max_entry_groups; ++i)
+            entry_group_ids[i] = scored_groups[i].second;
+        return scored_groups.size();
+    }
+
+
+
+    // entry points for each group, the group entry point followed by vectors chosen by k-means++ seeding, so that
+    // any prefix of them is spread over the group in vector space
+    void UniNavGraph::compute_group_entry_point_sets() {
+        _group_entry_point_sets.clear();
+        _group_entry_point_sets.resize(_num_groups + 1);
+        omp_set_num_threads(_num_threads);
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (auto group_id=1; group_id<=_num_groups; ++group_id)
+            compute_group_entry_point_set(group_id);
+    }
+
+
+
+    void UniNavGraph::compute_group_entry_point_set(IdxType group_id) {
+        const auto& range = _group_id_to_range[group_id];
         const auto& group_entry_point = _group_entry_points[group_id];
-        visited_set.set(group_entry_point);
-        entry_points.emplace_back(group_entry_point);
-        
-        // randomly sample the other entry points
-        for (auto i=1; i<num_entry_points; ++i) {
-            auto entry_point = rand() % (group_range.second - group_range.first) + group_range.first;
-            if (visited_set.check(entry_point) == false) {
-                visited_set.set(entry_point);
-                entry_points.emplace_back(i + group_range.first);
+        IdxType num_points = range.second - range.first;
+        IdxType set_size = std::min<IdxType>(default_paras::ENTRY_POINT_SET_SIZE, num_points);
+        auto& entry_point_set = _group_entry_point_sets[group_id];
+        entry_point_set.clear();
+        entry_point_set.push_back(group_entry_point);
+
+        // small groups use all of their vectors
+        if (set_size == num_points) {
+            for (auto vec_id=range.first; vec_id<range.second; ++vec_id)
+                if (vec_id != group_entry_point)
+                    entry_point_set.push_back(vec_id);
+            return;
+        }
+
+        // vectors of the group, loaded for out-of-core builds and a view of the base storage otherwise
+        auto vecs = group_id < _group_storages.size() && _group_storages[group_id] != nullptr
+                  ? _group_storages[group_id] : create_storage(_base_storage, range.first, range.second);
+        auto dim = _base_storage->get_dim();
+
+        // k-means++ seeding, the next entry point is sampled with a weight growing with its distance to the closest
+        // chosen one, shifted to be non-negative for inner product distances
+        std::mt19937 rng(default_paras::RANDOM_SEED + group_id);
+        std::vector<float> min_dists(num_points, std::numeric_limits<float>::max());
+        std::vector<bool> chosen(num_points, false);
+        std::vector<double> weights(num_points);
+        IdxType last = group_entry_point - range.first;
+        chosen[last] = true;
+        while (entry_point_set.size() < set_size) {
+            float min_dist = std::numeric_limits<float>::max();
+            for (IdxType i=0; i<num_points; ++i) {
+                min_dists[i] = std::min(min_dists[i], _distance_handler->compute(vecs->get_vector(i), 
+                                                                                 vecs->get_vector(last), dim));
+                min_dist = std::min(min_dist, min_dists[i]);
             }
+            double total_weight = 0;
+            for (IdxType i=0; i<num_points; ++i) {
+                weights[i] = chosen[i] ? 0 : min_dists[i] - min_dist;
+                total_weight += weights[i];
+            }
+
+            // duplicates of the chosen vectors only, fall back to uniform sampling among the others
+            if (total_weight <= 0)
+                for (IdxType i=0; i<num_points; ++i)
+                    weights[i] = chosen[i] ? 0 : 1;
+            std::discrete_distribution<IdxType> dist(weights.begin(), weights.end());
+            last = dist(rng);
+            chosen[last] = true;
+            entry_point_set.push_back(last + range.first);
         }
     }
 
@@ -513,7 +1674,8 @@ namespace ANNS {
 
     IdxType UniNavGraph::iterate_to_fixed_point(const char* query, std::shared_ptr<SearchCache> search_cache, 
                                                 IdxType target_id, const std::vector<IdxType>& entry_points,
-                                                bool clear_search_queue, bool clear_visited_set) {
+                                                const SearchOptions& options, bool clear_search_queue, bool clear_visited_set,
+                                                QueryStats* stats) {
         auto dim = _base_storage->get_dim();
         auto& search_queue = search_cache->search_queue;
         auto& visited_set = search_cache->visited_set;
@@ -528,20 +1690,55 @@ namespace ANNS {
             search_queue.insert(entry_point, _distance_handler->compute(query, _base_storage->get_vector(entry_point), dim));
         IdxType num_cmps = entry_points.size();
 
+        // latency mode, several threads expand the closest candidates together
+        if (options.beam_width > 1)
+            return num_cmps + expand_beam_to_fixed_point(query, search_cache, options, stats);
+
+        // visited marks are prefetched twice as far ahead as vectors, so that the visited check before prefetching is cheap
+        const IdxType vec_lookahead = std::max<IdxType>(options.prefetch_lookahead, 1);
+        const IdxType mark_lookahead = 2 * vec_lookahead;
+
         // greedily expand closest nodes
+        IdxType num_stable = 0, num_hops = 0, num_charged_cmps = 0;
+        float kth_distance = std::numeric_limits<float>::max();
         while (search_queue.has_unexpanded_node()) {
+            if (terminate_early(search_queue, options, num_stable, kth_distance))
+                break;
+
+            // stop when the query runs out of budget, the clock is read every few expansions
+            if (search_cache->exceed_budget(num_cmps - num_charged_cmps, num_hops % std::max<IdxType>(options.budget_check_interval, 1) == 0))
+                break;
+            num_charged_cmps = num_cmps;
             const Candidate& cur = search_queue.get_closest_unexpanded();
+            num_hops++;
 
             // iterate neighbors
             {
                 std::lock_guard<std::mutex> lock(_graph->neighbor_locks[cur.id]);
                 neighbors = _graph->neighbors[cur.id];
             }
-            for (auto i=0; i<neighbors.size(); ++i) {
 
-                // prefetch
-                if (i+1 < neighbors.size() && visited_set.check(neighbors[i+1]) == false)
-                    _base_storage->prefetch_vec_by_id(neighbors[i+1]);
+            // the next candidate to expand is likely the current closest unexpanded one, fetch its neighbor list early
+            IdxType next_id = search_queue.has_unexpanded_node() ? search_queue.peek_closest_unexpanded().id : cur.id;
+            _graph->prefetch_neighbors(next_id);
+
+            // fill the pipeline
+            IdxType num_neighbors = neighbors.size();
+            for (IdxType i=0; i<num_neighbors && i<mark_lookahead; ++i)
+                visited_set.prefetch(neighbors[i]);
+            for (IdxType i=0; i<num_neighbors && i<vec_lookahead; ++i)
+                if (visited_set.check(neighbors[i]) == false)
+                    _base_storage->prefetch_vec_by_id(neighbors[i]);
+
+            for (IdxType i=0; i<num_neighbors; ++i) {
+
+                // prefetch ahead
+                if (i + mark_lookahead < num_neighbors)
+                    visited_set.prefetch(neighbors[i + mark_lookahead]);
+                if (i + vec_lookahead < num_neighbors && visited_set.check(neighbors[i + vec_lookahead]) == false)
+                    _base_storage->prefetch_vec_by_id(neighbors[i + vec_lookahead]);
+                if (i == vec_lookahead)
+                    _graph->prefetch_neighbor_ids(next_id);
 
                 // skip if visited
                 auto& neighbor = neighbors[i];
@@ -554,6 +1751,92 @@ namespace ANNS {
                 num_cmps++;
             }
         }
+
+        if (stats != nullptr) {
+            stats->num_hops += num_hops;
+            stats->num_hops_saved += search_queue.num_unexpanded();
+        }
+        return num_cmps;
+    }
+
+
+
+    bool UniNavGraph::terminate_early(const SearchQueue& search_queue, const SearchOptions& options, 
+                                      IdxType& num_stable, float& kth_distance) {
+        IdxType K = std::min<IdxType>(_K, search_queue.capacity());
+        if (search_queue.size() < K)
+            return false;
+        float cur_kth_distance = search_queue[K-1].distance;
+
+        // the closest unexpanded candidate is far beyond the current K-th result
+        if (options.distance_ratio > 0 && 
+            search_queue.peek_closest_unexpanded().distance > options.distance_ratio * cur_kth_distance)
+            return true;
+
+        // the top-K results have not changed for a number of expansions
+        if (options.patience > 0) {
+            if (cur_kth_distance == kth_distance)
+                return ++num_stable >= options.patience;
+            kth_distance = cur_kth_distance;
+            num_stable = 0;
+        }
+        return false;
+    }
+
+
+
+    IdxType UniNavGraph::expand_beam_to_fixed_point(const char* query, std::shared_ptr<SearchCache> search_cache,
+                                                    const SearchOptions& options, QueryStats* stats) {
+        auto dim = _base_storage->get_dim();
+        auto& search_queue = search_cache->search_queue;
+        auto& visited_set = search_cache->visited_set;
+        IdxType num_cmps = 0;
+
+        std::vector<IdxType> beam;
+        std::vector<std::vector<Candidate>> beam_candidates(options.beam_width);
+        IdxType num_stable = 0, num_hops = 0, num_steps = 0, num_charged_cmps = 0;
+        float kth_distance = std::numeric_limits<float>::max();
+        while (search_queue.has_unexpanded_node()) {
+            if (terminate_early(search_queue, options, num_stable, kth_distance))
+                break;
+            if (search_cache->exceed_budget(num_cmps - num_charged_cmps, num_steps++ % std::max<IdxType>(options.budget_check_interval, 1) == 0))
+                break;
+            num_charged_cmps = num_cmps;
+
+            // take the closest unexpanded candidates
+            beam.clear();
+            while (beam.size() < options.beam_width && search_queue.has_unexpanded_node())
+                beam.push_back(search_queue.get_closest_unexpanded().id);
+
+            // expand them concurrently, threads race on the visited set so each neighbor is scored once
+            #pragma omp parallel for num_threads(_num_beam_threads) schedule(dynamic, 1) reduction(+:num_cmps)
+            for (IdxType i = 0; i < beam.size(); ++i) {
+                std::vector<IdxType> neighbors;
+                {
+                    std::lock_guard<std::mutex> lock(_graph->neighbor_locks[beam[i]]);
+                    neighbors = _graph->neighbors[beam[i]];
+                }
+                beam_candidates[i].clear();
+                for (const auto& neighbor : neighbors) {
+                    if (visited_set.check_and_set_atomic(neighbor))
+                        continue;
+                    beam_candidates[i].emplace_back(neighbor, 
+                        _distance_handler->compute(query, _base_storage->get_vector(neighbor), dim));
+                }
+                num_cmps += beam_candidates[i].size();
+            }
+
+            // merge into the search queue
+            for (IdxType i = 0; i < beam.size(); ++i)
+                for (const auto& candidate : beam_candidates[i])
+                    search_queue.insert(candidate.id, candidate.distance);
+            num_hops += beam.size();
+        }
+
+        if (stats != nullptr) {
+            stats->num_hops += num_hops;
+            stats->num_hops_saved += search_queue.num_unexpanded();
+        }
         return num_cmps;
     }
 
@@ -576,6 +1859,13 @@ namespace ANNS {
         meta_data["build_num_threads"] = std::to_string(_num_threads);
         meta_data["scenario"] = _scenario;
         meta_data["num_cross_edges"] = std::to_string(_num_cross_edges);
+        meta_data["remap_labels"] = std::to_string(!_label_map.empty());
+        meta_data["batch_insert"] = std::to_string(_build_options.batch_insert);
+        meta_data["nn_descent"] = std::to_string(_build_options.nn_descent);
+        meta_data["two_pass"] = std::to_string(_build_options.two_pass);
+        meta_data["prune_cross_edges"] = std::to_string(_build_options.prune_cross_edges);
+        meta_data["memory_budget(MB)"] = std::to_string(_build_options.memory_budget_mb);
+        meta_data["seed"] = std::to_string(_build_options.seed);
         meta_data["index_time(ms)"] = std::to_string(_index_time);
         meta_data["label_processing_time(ms)"] = std::to_string(_label_processing_time);
         meta_data["build_graph_time(ms)"] = std::to_string(_build_graph_time);
@@ -590,7 +1880,17 @@ namespace ANNS {
         // save vectors and label sets
         std::string bin_file = index_path_prefix + "vecs.bin";
         std::string label_file = index_path_prefix + "labels.txt";
-        _base_storage->write_to_file(bin_file, label_file);
+        if (_out_of_core) {
+            _base_storage->write_to_file("", label_file);
+            // the group-sorted vectors are moved into the index, like the spilled graph they are not left behind
+            if (!fs::exists(bin_file) || !fs::equivalent(_sorted_bin_file, bin_file)) {
+                fs::copy_file(_sorted_bin_file, bin_file, fs::copy_options::overwrite_existing);
+                fs::remove(_sorted_bin_file);
+                _sorted_bin_file = bin_file;
+            }
+        } else {
+            _base_storage->write_to_file(bin_file, label_file);
+        }
 
         // save group id to label set
         std::string group_id_to_label_set_filename = index_path_prefix + "group_id_to_label_set";
@@ -604,14 +1904,36 @@ namespace ANNS {
         std::string group_entry_points_filename = index_path_prefix + "group_entry_points";
         write_1d_vector(group_entry_points_filename, _group_entry_points);
 
+        // save group centroids
+        std::string group_centroids_filename = index_path_prefix + "group_centroids.bin";
+        _group_centroids->write_to_file(group_centroids_filename, "");
+
+        // save precomputed entry points of each group
+        std::string group_entry_point_sets_filename = index_path_prefix + "group_entry_point_sets";
+        write_2d_vectors(group_entry_point_sets_filename, _group_entry_point_sets);
+
         // save new to old vec ids
         std::string new_to_old_vec_ids_filename = index_path_prefix + "new_to_old_vec_ids";
         write_1d_vector(new_to_old_vec_ids_filename, _new_to_old_vec_ids);
 
+        // save label dictionary
+        if (!_label_map.empty()) {
+            std::string label_map_filename = index_path_prefix + "label_map";
+            write_1d_vector(label_map_filename, _label_map);
+        }
+
         // save trie index
         std::string trie_filename = index_path_prefix + "trie";
         _trie_index.save(trie_filename);
 
+        // save label navigating graph
+        if (_label_nav_graph != nullptr) {
+            std::string LNG_out_neighbors_filename = index_path_prefix + "LNG_out_neighbors";
+            std::string LNG_in_neighbors_filename = index_path_prefix + "LNG_in_neighbors";
+            write_2d_vectors(LNG_out_neighbors_filename, _label_nav_graph->out_neighbors);
+            write_2d_vectors(LNG_in_neighbors_filename, _label_nav_graph->in_neighbors);
+        }
+
         // save graph data
         std::string graph_filename = index_path_prefix + "graph";
         _graph->save(graph_filename);
@@ -632,6 +1954,11 @@ namespace ANNS {
         auto meta_data = parse_kv_file(meta_filename);
         _num_points = std::stoi(meta_data["num_points"]);
 
+        // entry groups cached for a previous index are invalid, the next search sets the cache up again
+        _label_set_cache.init(0);
+        _label_cache_capacity = 0;
+        _label_cache_scenario.clear();
+
         // load vectors and label sets
         std::string bin_file = index_path_prefix + "vecs.bin";
         std::string label_file = index_path_prefix + "labels.txt";
@@ -650,13 +1977,53 @@ namespace ANNS {
         std::string group_entry_points_filename = index_path_prefix + "group_entry_points";
         load_1d_vector(group_entry_points_filename, _group_entry_points);
 
+        // load group centroids, or compute them for indices built without centroids
+        _num_groups = std::stoi(meta_data["num_groups"]);
+        _num_threads = std::stoi(meta_data["build_num_threads"]);
+        std::string group_centroids_filename = index_path_prefix + "group_centroids.bin";
+        if (fs::exists(group_centroids_filename)) {
+            _group_centroids = create_storage(data_type, false);
+            _group_centroids->load_from_file(group_centroids_filename, "");
+        } else {
+            compute_group_centroids();
+        }
+
+        // load precomputed entry points of each group, indices built without them compute them at search time
+        std::string group_entry_point_sets_filename = index_path_prefix + "group_entry_point_sets";
+        _group_entry_point_sets.clear();
+        if (fs::exists(group_entry_point_sets_filename))
+            load_2d_vectors(group_entry_point_sets_filename, _group_entry_point_sets);
+
         // load new to old vec ids
         std::string new_to_old_vec_ids_filename = index_path_prefix + "new_to_old_vec_ids";
         load_1d_vector(new_to_old_vec_ids_filename, _new_to_old_vec_ids);
 
+        // load label dictionary
+        std::string label_map_filename = index_path_prefix + "label_map";
+        _label_map.clear();
+        if (fs::exists(label_map_filename)) {
+            load_1d_vector(label_map_filename, _label_map);
+            _unknown_label = *std::max_element(_label_map.begin(), _label_map.end()) + 1;
+        }
+
         // load trie index
         std::string trie_filename = index_path_prefix + "trie";
         _trie_index.load(trie_filename);
+        build_label_bitsets();
+
+        // load label navigating graph, or build it for indices saved without it
+        if (meta_data["scenario"] != "equality") {
+            std::string LNG_out_neighbors_filename = index_path_prefix + "LNG_out_neighbors";
+            std::string LNG_in_neighbors_filename = index_path_prefix + "LNG_in_neighbors";
+            if (fs::exists(LNG_out_neighbors_filename) && fs::exists(LNG_in_neighbors_filename)) {
+                _label_nav_graph = std::make_shared<LabelNavGraph>(_num_groups+1);
+                load_2d_vectors(LNG_out_neighbors_filename, _label_nav_graph->out_neighbors);
+                load_2d_vectors(LNG_in_neighbors_filename, _label_nav_graph->in_neighbors);
+                compute_root_group_ids();
+            } else {
+                build_label_nav_graph();
+            }
+        }
 
         // load graph data
         std::string graph_filename = index_path_prefix + "graph";
@@ -687,8 +2054,11 @@ namespace ANNS {
             _index_size += _group_id_to_label_set[i].size() * sizeof(LabelType);
         _index_size += _group_id_to_range.size() * sizeof(IdxType) * 2;
         _index_size += _group_entry_points.size() * sizeof(IdxType);
+        for (const auto& entry_point_set : _group_entry_point_sets)
+            _index_size += entry_point_set.size() * sizeof(IdxType);
         _index_size += _new_to_old_vec_ids.size() * sizeof(IdxType);
         _index_size += _trie_index.get_index_size();
+        _index_size += _group_label_bitsets.get_index_size();
         _index_size += _graph->get_index_size();
 
         // return as MB
@@ -0,0 +1,110 @@
+#include <random>
+#include <iostream>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include "trie.h"
+#include "flat_trie.h"
+
+namespace fs = boost::filesystem;
+
+
+
+// random sorted label set of 1 to max_size labels in [1, max_label], skewed to small labels
+std::vector<ANNS::LabelType> random_label_set(std::mt19937& rng, ANNS::LabelType max_label, uint32_t max_size) {
+    std::geometric_distribution<ANNS::LabelType> label_dist(4.0 / max_label);
+    std::uniform_int_distribution<uint32_t> size_dist(1, max_size);
+    std::vector<ANNS::LabelType> label_set;
+    for (auto size = size_dist(rng); label_set.size() < size; ) {
+        ANNS::LabelType label = 1 + label_dist(rng) % max_label;
+        if (std::find(label_set.begin(), label_set.end(), label) == label_set.end())
+            label_set.push_back(label);
+    }
+    std::sort(label_set.begin(), label_set.end());
+    return label_set;
+}
+
+
+
+// compare the group ids returned by both tries for the same queries, return the number of mismatches
+uint32_t compare_tries(const ANNS::TrieIndex& trie, const ANNS::FlatTrieIndex& flat_trie,
+                       const std::vector<std::vector<ANNS::LabelType>>& queries, const std::string& name) {
+    uint32_t num_errors = 0;
+    std::vector<std::shared_ptr<ANNS::TrieNode>> entrances;
+    std::vector<ANNS::IdxType> flat_entrances;
+    for (const auto& query : queries) {
+
+        // exact match
+        auto node = trie.find_exact_match(query);
+        auto flat_node = flat_trie.find_exact_match(query);
+        ANNS::IdxType group_id = node == nullptr ? 0 : node->group_id;
+        ANNS::IdxType flat_group_id = flat_node == ANNS::FlatTrieIndex::NONE ? 0 : flat_trie.get_node(flat_node).group_id;
+        if (group_id != flat_group_id)
+            num_errors++;
+
+        // super set entrances for all flags
+        for (bool avoid_self : {false, true}) {
+            for (bool need_containment : {false, true}) {
+                trie.get_super_set_entrances(query, entrances, avoid_self, need_containment);
+                flat_trie.get_super_set_entrances(query, flat_entrances, avoid_self, need_containment);
+                std::vector<ANNS::IdxType> group_ids, flat_group_ids;
+                for (const auto& entrance : entrances)
+                    group_ids.push_back(entrance->group_id);
+                for (auto entrance : flat_entrances)
+                    flat_group_ids.push_back(flat_trie.get_node(entrance).group_id);
+                std::sort(group_ids.begin(), group_ids.end());
+                std::sort(flat_group_ids.begin(), flat_group_ids.end());
+                if (group_ids != flat_group_ids)
+                    num_errors++;
+            }
+        }
+    }
+    if (num_errors > 0)
+        std::cerr << name << ": " << num_errors << " mismatches" << std::endl;
+    return num_errors;
+}
+
+
+
+int main(int argc, char** argv) {
+    std::mt19937 rng(ANNS::default_paras::RANDOM_SEED);
+    std::string trie_file = (fs::temp_directory_path() / fs::unique_path("test_flat_trie_%%%%%%%%")).string();
+    uint32_t num_errors = 0;
+
+    // a small label universe uses path bitsets, a large one does not
+    for (ANNS::LabelType max_label : {20, 1000}) {
+        ANNS::TrieIndex trie;
+        ANNS::FlatTrieIndex flat_trie;
+        ANNS::IdxType new_label_set_id = 1, new_flat_label_set_id = 1;
+        for (auto i=0; i<5000; ++i) {
+            auto label_set = random_label_set(rng, max_label, 5);
+            trie.insert(label_set, new_label_set_id);
+            flat_trie.insert(label_set, new_flat_label_set_id);
+        }
+
+        // queries of existing and unseen label sets, and the empty label set
+        std::vector<std::vector<ANNS::LabelType>> queries = {{}};
+        for (auto i=0; i<500; ++i)
+            queries.push_back(random_label_set(rng, max_label, 3));
+        std::string name = "max_label=" + std::to_string(max_label);
+        num_errors += compare_tries(trie, flat_trie, queries, name + ", before compaction");
+        flat_trie.compact_children();
+        flat_trie.build_path_bitsets();
+        num_errors += compare_tries(trie, flat_trie, queries, name + ", after compaction");
+
+        // the file format is shared, each trie loads the file saved by the other one
+        flat_trie.save(trie_file);
+        ANNS::TrieIndex loaded_trie;
+        loaded_trie.load(trie_file);
+        num_errors += compare_tries(loaded_trie, flat_trie, queries, name + ", trie loaded from flat trie");
+        trie.save(trie_file);
+        ANNS::FlatTrieIndex loaded_flat_trie;
+        loaded_flat_trie.load(trie_file);
+        num_errors += compare_tries(trie, loaded_flat_trie, queries, name + ", flat trie loaded from trie");
+    }
+    fs::remove(trie_file);
+
+    if (num_errors > 0)
+        return -1;
+    std::cout << "FlatTrieIndex matches TrieIndex" << std::endl;
+    return 0;
+}
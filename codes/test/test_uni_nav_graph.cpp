@@ -0,0 +1,189 @@
+#include <random>
+#include <iostream>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include "trie.h"
+#include "uni_nav_graph.h"
+
+namespace fs = boost::filesystem;
+
+const ANNS::IdxType NUM_POINTS = 3000, NUM_QUERIES = 300, DIM = 16, K = 10;
+const ANNS::LabelType MAX_LABEL = 12;
+
+
+
+// random sorted label set of 1 to max_size labels in [1, MAX_LABEL], skewed to small labels
+std::vector<ANNS::LabelType> random_label_set(std::mt19937& rng, uint32_t max_size) {
+    std::geometric_distribution<ANNS::LabelType> label_dist(0.3);
+    std::uniform_int_distribution<uint32_t> size_dist(1, max_size);
+    std::vector<ANNS::LabelType> label_set;
+    for (auto size = size_dist(rng); label_set.size() < size; ) {
+        ANNS::LabelType label = 1 + label_dist(rng) % MAX_LABEL;
+        if (std::find(label_set.begin(), label_set.end(), label) == label_set.end())
+            label_set.push_back(label);
+    }
+    std::sort(label_set.begin(), label_set.end());
+    return label_set;
+}
+
+
+
+// storage of random vectors with the given label sets
+std::shared_ptr<ANNS::IStorage> random_storage(std::mt19937& rng, const std::vector<std::vector<ANNS::LabelType>>& label_sets) {
+    std::uniform_real_distribution<float> value_dist(0, 1);
+    auto storage = ANNS::create_storage("float", false);
+    storage->init(label_sets.size(), DIM);
+    for (ANNS::IdxType i=0; i<label_sets.size(); ++i) {
+        auto vec = reinterpret_cast<float*>(storage->get_vector(i));
+        for (ANNS::IdxType d=0; d<DIM; ++d)
+            vec[d] = value_dist(rng);
+        storage->get_label_set(i) = label_sets[i];
+    }
+    return storage;
+}
+
+
+
+// minimum super sets of a label set found by pairwise comparisons over the baseline trie, as in the original search
+std::vector<std::vector<ANNS::LabelType>> baseline_min_super_sets(const ANNS::TrieIndex& trie,
+                                                                  const std::vector<ANNS::LabelType>& label_set,
+                                                                  bool avoid_self, bool need_containment,
+                                                                  const std::vector<std::vector<ANNS::LabelType>>& group_label_sets) {
+    std::vector<std::shared_ptr<ANNS::TrieNode>> candidates;
+    trie.get_super_set_entrances(label_set, candidates, avoid_self, need_containment);
+    std::sort(candidates.begin(), candidates.end(),
+              [](const std::shared_ptr<ANNS::TrieNode>& a, const std::shared_ptr<ANNS::TrieNode>& b) {
+                  return a->label_set_size < b->label_set_size;
+              });
+    std::vector<std::vector<ANNS::LabelType>> min_super_sets;
+    for (const auto& candidate : candidates) {
+        const auto& cur_label_set = group_label_sets[candidate->group_id];
+        bool is_min = true;
+        for (const auto& min_label_set : min_super_sets)
+            if (cur_label_set.size() > min_label_set.size() &&
+                std::includes(cur_label_set.begin(), cur_label_set.end(), min_label_set.begin(), min_label_set.end()))
+                is_min = false;
+        if (is_min)
+            min_super_sets.push_back(cur_label_set);
+    }
+    std::sort(min_super_sets.begin(), min_super_sets.end());
+    return min_super_sets;
+}
+
+
+
+// the entry groups resolved with the label navigating graph are the minimum super sets of the baseline
+uint32_t test_entry_groups(ANNS::UniNavGraph& index, const std::vector<std::vector<ANNS::LabelType>>& base_label_sets,
+                           const std::vector<std::vector<ANNS::LabelType>>& query_label_sets) {
+    ANNS::TrieIndex trie;
+    ANNS::IdxType new_label_set_id = 1;
+    std::vector<std::vector<ANNS::LabelType>> group_label_sets(1);
+    for (const auto& label_set : base_label_sets)
+        if (trie.insert(label_set, new_label_set_id) == group_label_sets.size())
+            group_label_sets.push_back(label_set);
+
+    uint32_t num_errors = 0;
+    std::vector<ANNS::IdxType> entry_group_ids;
+    for (std::string scenario : {"containment", "overlap", "nofilter"}) {
+        for (const auto& query_label_set : query_label_sets) {
+            std::vector<std::vector<ANNS::LabelType>> expected;
+            if (scenario == "nofilter")
+                expected = baseline_min_super_sets(trie, {}, true, true, group_label_sets);
+            else
+                expected = baseline_min_super_sets(trie, query_label_set, false, scenario == "containment",
+                                                   group_label_sets);
+            index.get_entry_groups(query_label_set, scenario, entry_group_ids);
+            std::vector<std::vector<ANNS::LabelType>> resolved;
+            for (auto group_id : entry_group_ids)
+                resolved.push_back(index.get_group_label_set(group_id));
+            std::sort(resolved.begin(), resolved.end());
+            if (resolved != expected)
+                num_errors++;
+        }
+        if (num_errors > 0) {
+            std::cerr << scenario << ": entry groups differ from the baseline for " << num_errors << " queries" << std::endl;
+            return num_errors;
+        }
+    }
+    return 0;
+}
+
+
+
+// a search with the given options returns the same results and counts as many comparisons as the default search
+uint32_t test_same_results(ANNS::UniNavGraph& index, std::shared_ptr<ANNS::IStorage> query_storage,
+                           std::shared_ptr<ANNS::DistanceHandler> distance_handler, const ANNS::SearchOptions& options,
+                           const std::string& name) {
+    uint32_t num_errors = 0;
+    for (std::string scenario : {"containment", "overlap"}) {
+        std::vector<std::pair<ANNS::IdxType, float>> expected(NUM_QUERIES * K), results(NUM_QUERIES * K);
+        std::vector<float> expected_num_cmps(NUM_QUERIES), num_cmps(NUM_QUERIES);
+        ANNS::SearchOptions default_options;
+        default_options.patience = options.patience;
+        default_options.max_num_cmps = options.max_num_cmps;
+        index.search(query_storage, distance_handler, 2, 50, 4, scenario, K, expected.data(), expected_num_cmps, 
+                     default_options);
+        index.search(query_storage, distance_handler, 2, 50, 4, scenario, K, results.data(), num_cmps, options);
+        if (results != expected || num_cmps != expected_num_cmps) {
+            std::cerr << scenario << ": results differ " << name << std::endl;
+            num_errors++;
+        }
+    }
+    return num_errors;
+}
+
+
+
+int main(int argc, char** argv) {
+    std::mt19937 rng(ANNS::default_paras::RANDOM_SEED);
+    std::string index_path_prefix = (fs::temp_directory_path() / fs::unique_path("test_ung_%%%%%%%%")).string() + "/";
+    fs::create_directories(index_path_prefix);
+
+    // base vectors, and queries with existing label sets, subsets of them and random label sets
+    std::vector<std::vector<ANNS::LabelType>> base_label_sets(NUM_POINTS), query_label_sets(NUM_QUERIES);
+    for (auto& label_set : base_label_sets)
+        label_set = random_label_set(rng, 4);
+    for (ANNS::IdxType i=0; i<NUM_QUERIES; ++i) {
+        query_label_sets[i] = base_label_sets[rng() % NUM_POINTS];
+        if (i % 3 == 1)
+            query_label_sets[i].erase(query_label_sets[i].begin() + rng() % query_label_sets[i].size());
+        else if (i % 3 == 2)
+            query_label_sets[i] = random_label_set(rng, 2);
+    }
+    auto base_storage = random_storage(rng, base_label_sets);
+    auto query_storage = random_storage(rng, query_label_sets);
+    std::shared_ptr<ANNS::DistanceHandler> distance_handler = ANNS::get_distance_handler("float", "L2");
+
+    // build and save an index, then search a loaded copy as the apps do
+    {
+        ANNS::UniNavGraph index;
+        index.build(base_storage, distance_handler, "general", "Vamana", 2, 6, 16, 40, 1.2);
+        index.save(index_path_prefix);
+    }
+    ANNS::UniNavGraph index;
+    index.load(index_path_prefix, "float");
+    fs::remove_all(index_path_prefix);
+
+    uint32_t num_errors = test_entry_groups(index, base_label_sets, query_label_sets);
+
+    // batch mode
+    ANNS::SearchOptions options;
+    options.group_by_label_set = true;
+    num_errors += test_same_results(index, query_storage, distance_handler, options, "with group_by_label_set");
+    options.label_cache_capacity = 16;
+    num_errors += test_same_results(index, query_storage, distance_handler, options, 
+                                    "with group_by_label_set and a label cache");
+
+    // interleaved queries, also with early termination and a comparison budget
+    options = ANNS::SearchOptions();
+    options.num_interleaved_queries = 4;
+    num_errors += test_same_results(index, query_storage, distance_handler, options, "with interleaving");
+    options.patience = 5;
+    options.max_num_cmps = 300;
+    num_errors += test_same_results(index, query_storage, distance_handler, options, 
+                                    "with interleaving, patience and max_num_cmps");
+    if (num_errors > 0)
+        return -1;
+    std::cout << "UniNavGraph matches the baseline" << std::endl;
+    return 0;
+}
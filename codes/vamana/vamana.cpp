@@ -1,5 +1,6 @@
 #include <omp.h>
 #include <iostream>
+#include <random>
 #include <algorithm>
 #include <boost/filesystem.hpp>
 #include "utils.h"
@@ -13,7 +14,7 @@ namespace ANNS {
 
     void Vamana::build(std::shared_ptr<IStorage> base_storage, std::shared_ptr<DistanceHandler> distance_handler, 
                        std::shared_ptr<Graph> graph, IdxType max_degree, IdxType Lbuild, float alpha, 
-                       uint32_t num_threads, IdxType max_candidate_size) {
+                       uint32_t num_threads, IdxType max_candidate_size, const BuildOptions& options) {
         
         if (_verbose) {
             std::cout << "Building Vamana index ..." << std::endl;
@@ -22,6 +23,9 @@ namespace ANNS {
             std::cout << "- alpha: " << alpha << std::endl;
             std::cout << "- max_candidate_size: " << max_candidate_size << std::endl;
             std::cout << "- num_threads: " << num_threads << std::endl;
+            std::cout << "- batch_insert: " << options.batch_insert << std::endl;
+            std::cout << "- two_pass: " << options.two_pass << std::endl;
+            std::cout << "- nn_descent: " << options.nn_descent << std::endl;
         }
         
         _base_storage = base_storage;
@@ -38,9 +42,34 @@ namespace ANNS {
             std::cout << "Computing entry point ..." << std::endl;
         _entry_point = _base_storage->choose_medoid(num_threads, distance_handler);
 
-        if (_verbose)
-            std::cout << "Linking the graph ..." << std::endl;
-        link();
+        // insertion order, id order unless randomized by one of the options
+        std::vector<IdxType> order(_base_storage->get_num_points());
+        for (IdxType id = 0; id < order.size(); ++id)
+            order[id] = id;
+        if (options.batch_insert || options.two_pass) {
+            std::mt19937 rng(options.seed);
+            std::shuffle(order.begin(), order.end(), rng);
+        }
+
+        // an approximate kNN graph refined by pruning replaces the insertions
+        if (options.nn_descent) {
+            if (_verbose)
+                std::cout << "Initializing the graph by NN-Descent ..." << std::endl;
+            nn_descent(options.seed);
+
+        // with two passes, the first one with alpha=1 builds a sparse graph that the second one refines
+        } else {
+            uint32_t num_passes = options.two_pass ? 2 : 1;
+            for (uint32_t pass = 0; pass < num_passes; ++pass) {
+                _alpha = (pass + 1 < num_passes) ? 1.0f : alpha;
+                if (_verbose)
+                    std::cout << "Linking the graph with alpha " << _alpha << " ..." << std::endl;
+                if (options.batch_insert)
+                    batch_link(order);
+                else
+                    link(order);
+            }
+        }
 
         if (_verbose)
             std::cout << "Finish." << std::endl << SEP_LINE;
@@ -48,14 +77,15 @@ namespace ANNS {
 
 
 
-    void Vamana::link() {
+    void Vamana::link(const std::vector<IdxType>& order) {
         auto num_points = _base_storage->get_num_points();
         auto dim = _base_storage->get_dim();
         SearchCacheList search_cache_list(_num_threads, num_points, _Lbuild);
 
         omp_set_num_threads(_num_threads);
         #pragma omp parallel for schedule(dynamic, 1)
-        for (auto id = 0; id < num_points; ++id) {
+        for (auto i = 0; i < num_points; ++i) {
+            auto id = order[i];
             auto search_cache = search_cache_list.get_free_cache();
 
             // search for point 
@@ -75,8 +105,8 @@ namespace ANNS {
 
             // clean and print
             search_cache_list.release_cache(search_cache);
-            if (_verbose && id % 10000 == 0)
-                std::cout << "\r" << (100.0 * id) / num_points << "%" << std::flush;
+            if (_verbose && i % 10000 == 0)
+                std::cout << "\r" << (100.0 * i) / num_points << "%" << std::flush;
         }
 
         if (_verbose)
@@ -101,6 +131,275 @@ namespace ANNS {
 
 
 
+    void Vamana::batch_link(std::vector<IdxType> order) {
+        auto num_points = _base_storage->get_num_points();
+        SearchCacheList search_cache_list(_num_threads, num_points, _Lbuild);
+
+        // the entry point is already in the graph
+        order.erase(std::remove(order.begin(), order.end(), _entry_point), order.end());
+
+        // batch sizes double until reaching a fraction of the points, so that early points see a connected graph
+        IdxType max_batch_size = std::max<IdxType>(1, num_points * default_paras::BATCH_INSERT_MAX_FRACTION);
+        std::vector<IdxType> batch;
+        std::vector<std::vector<IdxType>> new_neighbors;
+        omp_set_num_threads(_num_threads);
+        for (IdxType start = 0, batch_size = 1; start < order.size(); 
+             start += batch_size, batch_size = std::min(batch_size * 2, max_batch_size)) {
+            IdxType end = std::min<IdxType>(start + batch_size, order.size());
+            batch.assign(order.begin() + start, order.begin() + end);
+            new_neighbors.assign(batch.size(), std::vector<IdxType>());
+
+            // search and prune against the graph frozen before this batch
+            #pragma omp parallel for schedule(dynamic, 1)
+            for (IdxType i = 0; i < batch.size(); ++i) {
+                auto search_cache = search_cache_list.get_free_cache();
+                iterate_to_fixed_point(_base_storage->get_vector(batch[i]), search_cache, true, batch[i]);
+                prune_neighbors(batch[i], search_cache->expanded_list, new_neighbors[i], search_cache);
+                search_cache_list.release_cache(search_cache);
+            }
+
+            // publish the batch and insert the reversed edges
+            for (IdxType i = 0; i < batch.size(); ++i)
+                _graph->neighbors[batch[i]] = new_neighbors[i];
+            batch_inter_insert(batch, new_neighbors, search_cache_list);
+
+            if (_verbose)
+                std::cout << "\r" << (100.0 * end) / num_points << "%" << std::flush;
+        }
+        if (_verbose)
+            std::cout << std::endl;
+    }
+
+
+
+    void Vamana::batch_inter_insert(const std::vector<IdxType>& batch, std::vector<std::vector<IdxType>>& new_neighbors, 
+                                    SearchCacheList& search_cache_list) {
+        auto dim = _base_storage->get_dim();
+
+        // group the reversed edges by destination with a parallel semisort, so that each destination is updated by
+        // one thread: each thread scatters its edges into buckets of destination ranges, then each bucket is sorted
+        auto num_points = _base_storage->get_num_points();
+        size_t num_buckets = static_cast<size_t>(_num_threads) * default_paras::SEMISORT_BUCKETS_PER_THREAD;
+        auto get_bucket = [&](IdxType dst) { return static_cast<uint64_t>(dst) * num_buckets / num_points; };
+        std::vector<std::vector<size_t>> bucket_offsets(_num_threads, std::vector<size_t>(num_buckets, 0));
+        std::vector<size_t> bucket_starts(num_buckets + 1, 0);
+        std::vector<std::pair<IdxType, IdxType>> reversed_edges;
+        #pragma omp parallel num_threads(_num_threads)
+        {
+            auto& offsets = bucket_offsets[omp_get_thread_num()];
+            #pragma omp for schedule(static)
+            for (IdxType i = 0; i < batch.size(); ++i)
+                for (auto dst : new_neighbors[i])
+                    offsets[get_bucket(dst)] += 1;
+
+            // bucket by bucket, the edges of a thread follow those of the threads before it
+            #pragma omp single
+            {
+                size_t offset = 0;
+                for (size_t b = 0; b < num_buckets; ++b) {
+                    bucket_starts[b] = offset;
+                    for (auto& thread_offsets : bucket_offsets) {
+                        auto count = thread_offsets[b];
+                        thread_offsets[b] = offset;
+                        offset += count;
+                    }
+                }
+                bucket_starts[num_buckets] = offset;
+                reversed_edges.resize(offset);
+            }
+
+            // same static schedule as the counting loop
+            #pragma omp for schedule(static)
+            for (IdxType i = 0; i < batch.size(); ++i)
+                for (auto dst : new_neighbors[i])
+                    reversed_edges[offsets[get_bucket(dst)]++] = std::make_pair(dst, batch[i]);
+
+            #pragma omp for schedule(dynamic, 1)
+            for (size_t b = 0; b < num_buckets; ++b)
+                std::sort(reversed_edges.begin() + bucket_starts[b], reversed_edges.begin() + bucket_starts[b+1]);
+        }
+        std::vector<size_t> dst_starts;
+        for (size_t i = 0; i < reversed_edges.size(); ++i)
+            if (i == 0 || reversed_edges[i].first != reversed_edges[i-1].first)
+                dst_starts.push_back(i);
+        dst_starts.push_back(reversed_edges.size());
+
+        // append the new sources, or prune the union if the degree bound is exceeded
+        size_t num_dsts = dst_starts.size() - 1;
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t k = 0; k < num_dsts; ++k) {
+            auto dst = reversed_edges[dst_starts[k]].first;
+            auto& dst_neighbors = _graph->neighbors[dst];
+            if (dst_neighbors.size() + dst_starts[k+1] - dst_starts[k] <= _max_degree) {
+                for (auto i = dst_starts[k]; i < dst_starts[k+1]; ++i)
+                    if (std::find(dst_neighbors.begin(), dst_neighbors.end(), reversed_edges[i].second) == dst_neighbors.end())
+                        dst_neighbors.push_back(reversed_edges[i].second);
+                continue;
+            }
+
+            std::vector<Candidate> candidates;
+            candidates.reserve(dst_neighbors.size() + dst_starts[k+1] - dst_starts[k]);
+            for (auto& neighbor : dst_neighbors)
+                candidates.emplace_back(neighbor, _distance_handler->compute(_base_storage->get_vector(dst), 
+                                                                             _base_storage->get_vector(neighbor), dim));
+            for (auto i = dst_starts[k]; i < dst_starts[k+1]; ++i)
+                candidates.emplace_back(reversed_edges[i].second, 
+                                        _distance_handler->compute(_base_storage->get_vector(dst), 
+                                                                   _base_storage->get_vector(reversed_edges[i].second), dim));
+            auto search_cache = search_cache_list.get_free_cache();
+            prune_neighbors(dst, candidates, dst_neighbors, search_cache);
+            search_cache_list.release_cache(search_cache);
+        }
+    }
+
+
+
+    void Vamana::nn_descent(uint32_t seed) {
+        auto num_points = _base_storage->get_num_points();
+        auto dim = _base_storage->get_dim();
+        IdxType K = std::min<IdxType>(_max_degree / 2, num_points - 1);
+        IdxType num_samples = std::max<IdxType>(1, K * default_paras::NN_DESCENT_SAMPLE_RATE);
+        SearchCacheList search_cache_list(_num_threads, num_points, _Lbuild);
+        omp_set_num_threads(_num_threads);
+
+        // random initial neighbors sorted by distance, a candidate is new until it has been sampled for a join
+        std::vector<std::vector<Candidate>> knn(num_points);
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (IdxType u = 0; u < num_points; ++u) {
+            auto search_cache = search_cache_list.get_free_cache();
+            auto& visited_set = search_cache->visited_set;
+            visited_set.clear();
+            visited_set.set(u);
+            std::mt19937 rng(seed + u);
+            std::uniform_int_distribution<IdxType> uniform(0, num_points - 1);
+            knn[u].reserve(K);
+            while (knn[u].size() < K) {
+                auto v = uniform(rng);
+                if (visited_set.check(v))
+                    continue;
+                visited_set.set(v);
+                knn[u].emplace_back(v, _distance_handler->compute(_base_storage->get_vector(u), 
+                                                                  _base_storage->get_vector(v), dim));
+            }
+            std::sort(knn[u].begin(), knn[u].end());
+            search_cache_list.release_cache(search_cache);
+        }
+
+        std::vector<std::vector<IdxType>> new_ids(num_points), old_ids(num_points);
+        std::vector<std::vector<IdxType>> reversed_new_ids(num_points), reversed_old_ids(num_points);
+        for (IdxType iter = 0; iter < default_paras::NN_DESCENT_MAX_ITERS; ++iter) {
+
+            // sample new neighbors and mark them as old for the next iterations
+            #pragma omp parallel for schedule(dynamic, 64)
+            for (IdxType u = 0; u < num_points; ++u) {
+                new_ids[u].clear();
+                old_ids[u].clear();
+                for (auto& candidate : knn[u])
+                    if (candidate.expanded) {
+                        old_ids[u].push_back(candidate.id);
+                    } else if (new_ids[u].size() < num_samples) {
+                        new_ids[u].push_back(candidate.id);
+                        candidate.expanded = true;
+                    }
+            }
+
+            // add sampled reversed neighbors
+            for (IdxType u = 0; u < num_points; ++u) {
+                reversed_new_ids[u].clear();
+                reversed_old_ids[u].clear();
+            }
+            for (IdxType u = 0; u < num_points; ++u) {
+                for (auto v : new_ids[u])
+                    if (reversed_new_ids[v].size() < num_samples)
+                        reversed_new_ids[v].push_back(u);
+                for (auto v : old_ids[u])
+                    if (reversed_old_ids[v].size() < num_samples)
+                        reversed_old_ids[v].push_back(u);
+            }
+            #pragma omp parallel for schedule(dynamic, 64)
+            for (IdxType u = 0; u < num_points; ++u) {
+                new_ids[u].insert(new_ids[u].end(), reversed_new_ids[u].begin(), reversed_new_ids[u].end());
+                old_ids[u].insert(old_ids[u].end(), reversed_old_ids[u].begin(), reversed_old_ids[u].end());
+            }
+
+            // local join seen from each point, only pairs involving a new neighbor are examined, and only the list
+            // of the point itself is updated, so no locks are needed
+            uint64_t num_updates = 0;
+            #pragma omp parallel for schedule(dynamic, 64) reduction(+:num_updates)
+            for (IdxType u = 0; u < num_points; ++u) {
+                auto search_cache = search_cache_list.get_free_cache();
+                auto& visited_set = search_cache->visited_set;
+                visited_set.clear();
+                visited_set.set(u);
+                for (const auto& candidate : knn[u])
+                    visited_set.set(candidate.id);
+
+                auto try_insert = [&](IdxType w) {
+                    if (visited_set.check(w))
+                        return;
+                    visited_set.set(w);
+                    Candidate candidate(w, _distance_handler->compute(_base_storage->get_vector(u), 
+                                                                      _base_storage->get_vector(w), dim));
+                    if (!(candidate < knn[u].back()))
+                        return;
+                    knn[u].insert(std::upper_bound(knn[u].begin(), knn[u].end(), candidate), candidate);
+                    knn[u].pop_back();
+                    num_updates++;
+                };
+                for (auto v : new_ids[u]) {
+                    for (auto w : new_ids[v])
+                        try_insert(w);
+                    for (auto w : old_ids[v])
+                        try_insert(w);
+                }
+                for (auto v : old_ids[u])
+                    for (auto w : new_ids[v])
+                        try_insert(w);
+                search_cache_list.release_cache(search_cache);
+            }
+
+            if (_verbose)
+                std::cout << "- iteration " << iter << ": " << num_updates << " updates" << std::endl;
+            if (num_updates <= default_paras::NN_DESCENT_DELTA * num_points * K)
+                break;
+        }
+
+        // the kNN graph alone is poorly navigable, so the kNN of each point together with the kNN of its neighbors
+        // are robust pruned, all against the frozen kNN graph and without any search
+        std::vector<IdxType> all_ids(num_points);
+        std::vector<std::vector<IdxType>> pruned_lists(num_points);
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (IdxType u = 0; u < num_points; ++u) {
+            all_ids[u] = u;
+            auto search_cache = search_cache_list.get_free_cache();
+            auto& visited_set = search_cache->visited_set;
+            auto& candidates = search_cache->expanded_list;
+            visited_set.clear();
+            visited_set.set(u);
+            candidates.clear();
+            for (const auto& candidate : knn[u]) {
+                visited_set.set(candidate.id);
+                candidates.push_back(candidate);
+            }
+            for (const auto& neighbor : knn[u])
+                for (const auto& candidate : knn[neighbor.id]) {
+                    if (visited_set.check(candidate.id))
+                        continue;
+                    visited_set.set(candidate.id);
+                    candidates.emplace_back(candidate.id, _distance_handler->compute(_base_storage->get_vector(u), 
+                                                                                     _base_storage->get_vector(candidate.id), dim));
+                }
+            robust_prune(u, candidates, pruned_lists[u], _alpha, _max_degree, std::min(_Lbuild, _max_candidate_size), 
+                         search_cache);
+            search_cache_list.release_cache(search_cache);
+        }
+        for (IdxType u = 0; u < num_points; ++u)
+            _graph->neighbors[u] = pruned_lists[u];
+        batch_inter_insert(all_ids, pruned_lists, search_cache_list);
+    }
+
+
+
     IdxType Vamana::iterate_to_fixed_point(const char* query, std::shared_ptr<SearchCache> search_cache, 
                                            bool record_expanded, IdxType target_id) {
         auto dim = _base_storage->get_dim();
@@ -153,15 +452,31 @@ namespace ANNS {
 
     void Vamana::prune_neighbors(IdxType id, std::vector<Candidate>& candidates, std::vector<IdxType>& pruned_list, 
                                     std::shared_ptr<SearchCache> search_cache) {
+        robust_prune(id, candidates, pruned_list, _alpha, _max_degree, _max_candidate_size, search_cache);
+    }
+
+
+
+    // candidates of a query outside the graph, e.g. from another group
+    void Vamana::prune_candidates(std::vector<Candidate>& candidates, std::vector<IdxType>& pruned_list, float alpha,
+                                  IdxType max_degree, std::shared_ptr<SearchCache> search_cache) {
+        robust_prune(-1, candidates, pruned_list, alpha, max_degree, candidates.size(), search_cache);
+    }
+
+
+
+    void Vamana::robust_prune(IdxType id, std::vector<Candidate>& candidates, std::vector<IdxType>& pruned_list, 
+                              float alpha, IdxType max_degree, IdxType max_candidate_size, 
+                              std::shared_ptr<SearchCache> search_cache) {
         auto dim = _base_storage->get_dim();
         pruned_list.clear();
-        pruned_list.reserve(_max_degree);
+        pruned_list.reserve(max_degree);
 
         // init candidates
         std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
             return a.distance < b.distance;
         });
-        auto candidate_size = std::min((IdxType)(candidates.size()), _max_candidate_size);
+        auto candidate_size = std::min((IdxType)(candidates.size()), max_candidate_size);
 
         // init occlude factor
         auto& occlude_factor = search_cache->occlude_factor;
@@ -170,8 +485,8 @@ namespace ANNS {
 
         // prune neighbors
         float cur_alpha = 1;
-        while (cur_alpha <= _alpha && pruned_list.size() < _max_degree) {
-            for (auto i=0; i<candidate_size && pruned_list.size() < _max_degree; ++i) {
+        while (cur_alpha <= alpha && pruned_list.size() < max_degree) {
+            for (auto i=0; i<candidate_size && pruned_list.size() < max_degree; ++i) {
                 if (occlude_factor[i] > cur_alpha) 
                     continue;
 
@@ -182,7 +497,7 @@ namespace ANNS {
 
                 // update occlude factor for the following candidates
                 for (auto j=i+1; j<candidate_size; ++j) {
-                    if (occlude_factor[j] > _alpha)
+                    if (occlude_factor[j] > alpha)
                         continue;
                     auto distance_ij = _distance_handler->compute(_base_storage->get_vector(candidates[i].id), 
                                                                 _base_storage->get_vector(candidates[j].id), dim);
@@ -21,7 +21,8 @@ namespace ANNS {
 
             void build(std::shared_ptr<IStorage> base_storage, std::shared_ptr<DistanceHandler> distance_handler, 
                        std::shared_ptr<Graph> graph, IdxType max_degree, IdxType Lbuild, float alpha, 
-                       uint32_t num_threads, IdxType max_candidate_size = default_paras::MAX_CANDIDATE_SIZE);
+                       uint32_t num_threads, IdxType max_candidate_size = default_paras::MAX_CANDIDATE_SIZE,
+                       const BuildOptions& options = BuildOptions());
 
             void search(std::shared_ptr<IStorage> base_storage, std::shared_ptr<IStorage> query_storage, 
                         std::shared_ptr<DistanceHandler> distance_handler, IdxType K, IdxType Lsearch, 
@@ -32,6 +33,10 @@ namespace ANNS {
             IdxType iterate_to_fixed_point(const char* query, std::shared_ptr<SearchCache> search_cache, 
                                            bool record_expanded = false, IdxType target_id = -1);
 
+            // robust prune with alpha-occlusion the candidates of a query that is not in the graph
+            void prune_candidates(std::vector<Candidate>& candidates, std::vector<IdxType>& pruned_list, float alpha,
+                                  IdxType max_degree, std::shared_ptr<SearchCache> search_cache);
+
             // stats and I/O
             void statistics();
             void save(std::string& index_path_prefix);
@@ -51,9 +56,16 @@ namespace ANNS {
             // build the graph
             IdxType _entry_point;
             std::shared_ptr<Graph> _graph;
-            void link();
+            void link(const std::vector<IdxType>& order);
+            void batch_link(std::vector<IdxType> order);
+            void nn_descent(uint32_t seed);
+            void batch_inter_insert(const std::vector<IdxType>& batch, std::vector<std::vector<IdxType>>& new_neighbors, 
+                                    SearchCacheList& search_cache_list);
             void prune_neighbors(IdxType id, std::vector<Candidate>& candidates, std::vector<IdxType>& pruned_list, 
                                  std::shared_ptr<SearchCache> search_cache);
+            void robust_prune(IdxType id, std::vector<Candidate>& candidates, std::vector<IdxType>& pruned_list, 
+                              float alpha, IdxType max_degree, IdxType max_candidate_size, 
+                              std::shared_ptr<SearchCache> search_cache);
             void inter_insert(IdxType src, std::vector<IdxType>& src_neighbors, std::shared_ptr<SearchCache> search_cache);
 
             // for logs